@@ -0,0 +1,86 @@
+#ifndef _AI_DRIVER_
+#define _AI_DRIVER_
+
+#include <Core/IListener.h>
+#include <Core/IModule.h>
+#include <Physics/RigidBox.h>
+#include <Math/Matrix.h>
+#include <Math/Vector.h>
+
+#include "VehicleFleet.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+using OpenEngine::Core::IListener;
+using OpenEngine::Core::ProcessEventArg;
+using OpenEngine::Math::Matrix;
+using OpenEngine::Math::Vector;
+
+/**
+ * Drives a set of fleet vehicles along a closed loop of waypoints.
+ *
+ * Each vehicle heads for its current waypoint at full throttle and
+ * steers proportionally to the sideways offset of the waypoint. When
+ * it gets within the waypoint radius it moves on to the next one.
+ */
+class AIDriver : public IListener<ProcessEventArg> {
+private:
+    VehicleFleet& fleet;
+    std::vector<unsigned int> slots;
+    std::vector<unsigned int> target;
+    std::vector< Vector<3,float> > waypoints;
+    float radius;
+
+public:
+    AIDriver(VehicleFleet& fleet, float radius = 30.0f)
+        : fleet(fleet)
+        , radius(radius)
+    {}
+
+    void AddVehicle(unsigned int slot) {
+        slots.push_back(slot);
+        target.push_back(0);
+    }
+
+    void AddWaypoint(Vector<3,float> p) { waypoints.push_back(p); }
+
+    const std::vector< Vector<3,float> >& GetWaypoints() const { return waypoints; }
+
+    /**
+     * A loop of waypoints on a circle in the ground plane.
+     */
+    void SetCircuit(Vector<3,float> center, float size, unsigned int count) {
+        waypoints.clear();
+        for (unsigned int i = 0; i < count; i++) {
+            float a = 2.0f * 3.14159265f * i / count;
+            waypoints.push_back(center + Vector<3,float>(cos(a) * size, 0, sin(a) * size));
+        }
+    }
+
+    void Handle(ProcessEventArg arg) {
+        if (waypoints.empty()) return;
+        for (unsigned int i = 0; i < slots.size(); i++) {
+            RigidBox* box = fleet.GetBox(slots[i]);
+            Vector<3,float> to = waypoints[target[i] % waypoints.size()] - box->GetCenter();
+            to[1] = 0;
+            if (to.GetLength() < radius) {
+                target[i] = (target[i] + 1) % waypoints.size();
+                continue;
+            }
+            Matrix<3,3,float> m(box->GetRotationMatrix());
+            Vector<3,float> dir = to * (1.0f / to.GetLength());
+            float ahead = m.GetRow(0) * dir;
+            float side = m.GetRow(2) * dir;
+            float steer = (ahead < 0) ? 1.0f : std::min(1.0f, std::fabs(side) * 2.0f);
+            fleet.SetControl(slots[i],
+                             1.0f,
+                             0.0f,
+                             side < 0 ? steer : 0.0f,
+                             side >= 0 ? steer : 0.0f);
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,77 @@
+// Counting replacements of the global allocation operators.
+// -------------------------------------------------------------------
+// Copyright (C) 2007 OpenEngine.dk (See AUTHORS) 
+// 
+// This program is free software; It is covered by the GNU General 
+// Public License version 2 or any later version. 
+// See the GNU General Public License for more details (see LICENSE). 
+//--------------------------------------------------------------------
+
+#include "AllocationCounter.h"
+
+#include <cstdlib>
+#include <new>
+
+#if defined(_MSC_VER)
+#include <windows.h>
+#define THREAD_LOCAL __declspec(thread)
+static volatile LONG allocations = 0;
+static inline void CountAllocation() { InterlockedIncrement(&allocations); }
+#else
+#define THREAD_LOCAL __thread
+static volatile unsigned long allocations = 0;
+static inline void CountAllocation() { __sync_fetch_and_add(&allocations, 1); }
+#endif
+
+// Dynamic exception specifications are ill-formed from C++17 on
+#if __cplusplus >= 201103L
+#define THROW_BAD_ALLOC noexcept(false)
+#define THROW_NOTHING noexcept
+#else
+#define THROW_BAD_ALLOC throw(std::bad_alloc)
+#define THROW_NOTHING throw()
+#endif
+
+static THREAD_LOCAL unsigned long threadAllocations = 0;
+
+unsigned long GetAllocationCount() {
+    return allocations;
+}
+
+unsigned long GetThreadAllocationCount() {
+    return threadAllocations;
+}
+
+static void* Allocate(std::size_t size) {
+    CountAllocation();
+    threadAllocations++;
+    void* p = std::malloc(size ? size : 1);
+    if (p == NULL) throw std::bad_alloc();
+    return p;
+}
+
+void* operator new(std::size_t size) THROW_BAD_ALLOC {
+    return Allocate(size);
+}
+
+void* operator new[](std::size_t size) THROW_BAD_ALLOC {
+    return Allocate(size);
+}
+
+void operator delete(void* p) THROW_NOTHING {
+    std::free(p);
+}
+
+void operator delete[](void* p) THROW_NOTHING {
+    std::free(p);
+}
+
+#if defined(__cpp_sized_deallocation)
+void operator delete(void* p, std::size_t) THROW_NOTHING {
+    std::free(p);
+}
+
+void operator delete[](void* p, std::size_t) THROW_NOTHING {
+    std::free(p);
+}
+#endif
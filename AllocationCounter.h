@@ -0,0 +1,16 @@
+#ifndef _ALLOCATION_COUNTER_
+#define _ALLOCATION_COUNTER_
+
+/**
+ * Counts the calls to the global operator new made by the program.
+ * The counters are maintained by the operators in
+ * AllocationCounter.cpp.
+ */
+
+// All allocations made by any thread.
+unsigned long GetAllocationCount();
+
+// Allocations made by the calling thread.
+unsigned long GetThreadAllocationCount();
+
+#endif
@@ -0,0 +1,532 @@
+#ifndef _COLLISION_BVH_
+#define _COLLISION_BVH_
+
+#include <Scene/ISceneNode.h>
+#include <Scene/ISceneNodeVisitor.h>
+#include <Scene/GeometryNode.h>
+#include <Scene/QuadNode.h>
+#include <Scene/BSPNode.h>
+#include <Geometry/Face.h>
+#include <Geometry/FaceSet.h>
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <map>
+#include <set>
+#include <utility>
+#include <vector>
+
+using OpenEngine::Scene::ISceneNode;
+using OpenEngine::Scene::ISceneNodeVisitor;
+using OpenEngine::Scene::GeometryNode;
+using OpenEngine::Scene::QuadNode;
+using OpenEngine::Scene::BSPNode;
+using OpenEngine::Geometry::Face;
+using OpenEngine::Geometry::FacePtr;
+using OpenEngine::Geometry::FaceSet;
+using OpenEngine::Geometry::FaceList;
+
+/**
+ * Triangle tests shared by the collision backends. Triangles are nine
+ * floats, boxes a low and a high corner.
+ */
+namespace CollisionTest {
+    inline void Bounds(const float* v, float* lo, float* hi) {
+        for (unsigned int k = 0; k < 3; k++) {
+            lo[k] = std::min(v[k], std::min(v[3+k], v[6+k]));
+            hi[k] = std::max(v[k], std::max(v[3+k], v[6+k]));
+        }
+    }
+
+    inline bool Overlap(const float* alo, const float* ahi,
+                        const float* blo, const float* bhi) {
+        return alo[0] <= bhi[0] && blo[0] <= ahi[0] &&
+               alo[1] <= bhi[1] && blo[1] <= ahi[1] &&
+               alo[2] <= bhi[2] && blo[2] <= ahi[2];
+    }
+
+    // Moeller-Trumbore, both sides. Sets t when the hit is closer.
+    inline bool Ray(const float* o, const float* d, const float* v, float& t) {
+        float e1[3], e2[3], p[3], s[3], q[3];
+        for (unsigned int k = 0; k < 3; k++) {
+            e1[k] = v[3+k] - v[k];
+            e2[k] = v[6+k] - v[k];
+        }
+        p[0] = d[1]*e2[2] - d[2]*e2[1];
+        p[1] = d[2]*e2[0] - d[0]*e2[2];
+        p[2] = d[0]*e2[1] - d[1]*e2[0];
+        float det = e1[0]*p[0] + e1[1]*p[1] + e1[2]*p[2];
+        if (std::fabs(det) < 1e-12f) return false;
+        float inv = 1.0f / det;
+        for (unsigned int k = 0; k < 3; k++) s[k] = o[k] - v[k];
+        float u = (s[0]*p[0] + s[1]*p[1] + s[2]*p[2]) * inv;
+        if (u < 0.0f || u > 1.0f) return false;
+        q[0] = s[1]*e1[2] - s[2]*e1[1];
+        q[1] = s[2]*e1[0] - s[0]*e1[2];
+        q[2] = s[0]*e1[1] - s[1]*e1[0];
+        float w = (d[0]*q[0] + d[1]*q[1] + d[2]*q[2]) * inv;
+        if (w < 0.0f || u + w > 1.0f) return false;
+        float h = (e2[0]*q[0] + e2[1]*q[1] + e2[2]*q[2]) * inv;
+        if (h < 0.0f || h >= t) return false;
+        t = h;
+        return true;
+    }
+
+    inline void Load(const FacePtr& face, float* v) {
+        for (unsigned int c = 0; c < 3; c++)
+            for (unsigned int k = 0; k < 3; k++)
+                v[3*c+k] = face->vert[c][k];
+    }
+}
+
+/**
+ * A flat bounding volume hierarchy over the triangles of a scene,
+ * built with the surface area heuristic over binned centroids.
+ *
+ * The nodes are one array with the children of an inner node next to
+ * each other, and the triangles are copied into leaf order, so queries
+ * walk contiguous memory. Overlap queries count the triangles whose
+ * bounds overlap a box, the broad phase of a box collision.
+ */
+class TriangleBVH {
+public:
+    struct Node {
+        float lo[3], hi[3];
+        unsigned int first; // first triangle, or left child of inner nodes
+        unsigned int count; // triangles of leaves, 0 for inner nodes
+    };
+
+private:
+    static const unsigned int BINS = 16;
+    static const unsigned int LEAF_SIZE = 2;
+    static const unsigned int MAX_LEAF_SIZE = 16;
+    static const unsigned int MAX_DEPTH = 48; // queries use fixed stacks
+
+    std::vector<Node> nodes;
+    std::vector<float> triangles; // nine floats each, in leaf order
+    std::vector<float> bounds;    // six floats each, in leaf order
+
+    static float Area(const float* lo, const float* hi) {
+        float x = hi[0] - lo[0], y = hi[1] - lo[1], z = hi[2] - lo[2];
+        return (x < 0.0f) ? 0.0f : 2.0f * (x*y + y*z + z*x);
+    }
+
+    static void Empty(float* lo, float* hi) {
+        for (unsigned int k = 0; k < 3; k++) {
+            lo[k] = FLT_MAX;
+            hi[k] = -FLT_MAX;
+        }
+    }
+
+    static void Grow(float* lo, float* hi, const float* plo, const float* phi) {
+        for (unsigned int k = 0; k < 3; k++) {
+            lo[k] = std::min(lo[k], plo[k]);
+            hi[k] = std::max(hi[k], phi[k]);
+        }
+    }
+
+    struct Partition {
+        const float* centroids;
+        unsigned int axis, split;
+        float min, scale;
+        unsigned int Bin(unsigned int t) const {
+            unsigned int b = (unsigned int)((centroids[3*t+axis] - min) * scale);
+            return (b < BINS) ? b : BINS - 1;
+        }
+        bool operator()(unsigned int t) const { return Bin(t) < split; }
+    };
+
+public:
+    void Build(FaceSet& faces) {
+        unsigned int n = faces.Size();
+        std::vector<float> verts(9 * n), tb(6 * n), centroids(3 * n);
+        std::vector<unsigned int> order(n);
+        unsigned int i = 0;
+        for (FaceList::iterator itr = faces.begin(); itr != faces.end(); itr++, i++) {
+            CollisionTest::Load(*itr, &verts[9*i]);
+            CollisionTest::Bounds(&verts[9*i], &tb[6*i], &tb[6*i+3]);
+            for (unsigned int k = 0; k < 3; k++)
+                centroids[3*i+k] = (tb[6*i+k] + tb[6*i+3+k]) * 0.5f;
+            order[i] = i;
+        }
+
+        nodes.clear();
+        if (n == 0) return;
+        nodes.reserve(2 * n);
+        Node root;
+        root.first = 0;
+        root.count = n;
+        nodes.push_back(root);
+
+        // node indices and depths
+        std::vector<std::pair<unsigned int, unsigned int> > stack;
+        stack.push_back(std::make_pair(0u, 0u));
+        while (!stack.empty()) {
+            unsigned int index = stack.back().first;
+            unsigned int depth = stack.back().second;
+            stack.pop_back();
+            Node& node = nodes[index];
+            float clo[3], chi[3];
+            Empty(node.lo, node.hi);
+            Empty(clo, chi);
+            for (unsigned int j = node.first; j < node.first + node.count; j++) {
+                unsigned int t = order[j];
+                Grow(node.lo, node.hi, &tb[6*t], &tb[6*t+3]);
+                Grow(clo, chi, &centroids[3*t], &centroids[3*t]);
+            }
+            if (node.count <= LEAF_SIZE || depth >= MAX_DEPTH) continue;
+
+            // the cheapest split over the bins of every axis
+            Partition best;
+            best.centroids = &centroids[0];
+            best.split = 0;
+            float bestCost = FLT_MAX;
+            for (unsigned int axis = 0; axis < 3; axis++) {
+                float extent = chi[axis] - clo[axis];
+                if (extent <= 0.0f) continue;
+                Partition p;
+                p.centroids = &centroids[0];
+                p.axis = axis;
+                p.min = clo[axis];
+                p.scale = BINS / extent;
+
+                unsigned int count[BINS] = {0};
+                float blo[BINS][3], bhi[BINS][3];
+                for (unsigned int b = 0; b < BINS; b++) Empty(blo[b], bhi[b]);
+                for (unsigned int j = node.first; j < node.first + node.count; j++) {
+                    unsigned int t = order[j];
+                    unsigned int b = p.Bin(t);
+                    count[b]++;
+                    Grow(blo[b], bhi[b], &tb[6*t], &tb[6*t+3]);
+                }
+
+                float rightArea[BINS];
+                unsigned int rightCount[BINS];
+                float lo[3], hi[3];
+                Empty(lo, hi);
+                unsigned int c = 0;
+                for (unsigned int b = BINS - 1; b > 0; b--) {
+                    Grow(lo, hi, blo[b], bhi[b]);
+                    c += count[b];
+                    rightArea[b] = Area(lo, hi);
+                    rightCount[b] = c;
+                }
+                Empty(lo, hi);
+                c = 0;
+                for (unsigned int b = 1; b < BINS; b++) {
+                    Grow(lo, hi, blo[b-1], bhi[b-1]);
+                    c += count[b-1];
+                    if (c == 0 || rightCount[b] == 0) continue;
+                    float cost = c * Area(lo, hi) + rightCount[b] * rightArea[b];
+                    if (cost < bestCost) {
+                        bestCost = cost;
+                        best = p;
+                        best.split = b;
+                    }
+                }
+            }
+            if (best.split == 0) continue; // all centroids in one point
+            if (bestCost >= node.count * Area(node.lo, node.hi) &&
+                node.count <= MAX_LEAF_SIZE)
+                continue;
+
+            unsigned int* begin = &order[0] + node.first;
+            unsigned int middle = std::partition(begin, begin + node.count, best) - &order[0];
+            Node left, right;
+            left.first = node.first;
+            left.count = middle - node.first;
+            right.first = middle;
+            right.count = node.first + node.count - middle;
+            node.first = nodes.size();
+            node.count = 0;
+            nodes.push_back(left);
+            nodes.push_back(right);
+            stack.push_back(std::make_pair(node.first, depth + 1));
+            stack.push_back(std::make_pair(node.first + 1, depth + 1));
+        }
+
+        triangles.resize(9 * n);
+        bounds.resize(6 * n);
+        for (unsigned int j = 0; j < n; j++) {
+            std::copy(&verts[9*order[j]], &verts[9*order[j]] + 9, &triangles[9*j]);
+            std::copy(&tb[6*order[j]], &tb[6*order[j]] + 6, &bounds[6*j]);
+        }
+    }
+
+    unsigned int GetNodeCount() const { return nodes.size(); }
+    unsigned int GetTriangleCount() const { return triangles.size() / 9; }
+
+    unsigned long GetBytes() const {
+        return (unsigned long)nodes.size() * sizeof(Node)
+            + (triangles.size() + bounds.size()) * sizeof(float);
+    }
+
+    /**
+     * The number of triangles whose bounds overlap the box.
+     */
+    unsigned int Overlaps(const float* lo, const float* hi) const {
+        if (nodes.empty()) return 0;
+        unsigned int count = 0;
+        unsigned int stack[MAX_DEPTH + 2];
+        unsigned int top = 0;
+        stack[top++] = 0;
+        while (top > 0) {
+            const Node& node = nodes[stack[--top]];
+            if (!CollisionTest::Overlap(node.lo, node.hi, lo, hi)) continue;
+            if (node.count == 0) {
+                stack[top++] = node.first;
+                stack[top++] = node.first + 1;
+                continue;
+            }
+            for (unsigned int j = node.first; j < node.first + node.count; j++)
+                if (CollisionTest::Overlap(&bounds[6*j], &bounds[6*j+3], lo, hi))
+                    count++;
+        }
+        return count;
+    }
+
+    /**
+     * The distance along d to the closest triangle hit before t, or t.
+     */
+    float Ray(const float* o, const float* d, float t) const {
+        if (nodes.empty()) return t;
+        float inv[3];
+        for (unsigned int k = 0; k < 3; k++)
+            inv[k] = (d[k] != 0.0f) ? 1.0f / d[k] : FLT_MAX;
+        unsigned int stack[MAX_DEPTH + 2];
+        unsigned int top = 0;
+        stack[top++] = 0;
+        while (top > 0) {
+            const Node& node = nodes[stack[--top]];
+            float enter = 0.0f, exit = t;
+            for (unsigned int k = 0; k < 3 && enter <= exit; k++) {
+                float a = (node.lo[k] - o[k]) * inv[k];
+                float b = (node.hi[k] - o[k]) * inv[k];
+                enter = std::max(enter, std::min(a, b));
+                exit = std::min(exit, std::max(a, b));
+            }
+            if (enter > exit) continue;
+            if (node.count == 0) {
+                stack[top++] = node.first;
+                stack[top++] = node.first + 1;
+                continue;
+            }
+            for (unsigned int j = node.first; j < node.first + node.count; j++)
+                CollisionTest::Ray(o, d, &triangles[9*j], t);
+        }
+        return t;
+    }
+};
+
+/**
+ * The same queries on the hybrid Quad/BSP tree the physics uses.
+ *
+ * Quad nodes are skipped when the query misses the bounds of their
+ * faces, which are found once when the query is made. BSP nodes test
+ * their divider and spanning faces and only descend into the sides the
+ * query reaches.
+ */
+class QuadBSPQuery : public ISceneNodeVisitor {
+private:
+    struct Box {
+        float lo[3], hi[3];
+    };
+
+    // Finds the bounds of the quad nodes and the size of the tree.
+    class Measure : public ISceneNodeVisitor {
+    public:
+        std::map<ISceneNode*, Box>& quads;
+        std::vector<Box> stack;
+        std::set<Face*> faces;
+        unsigned long bytes;
+        unsigned int references;
+
+        Measure(std::map<ISceneNode*, Box>& quads)
+            : quads(quads), bytes(0), references(0) {}
+
+        void Add(FaceSet* fs) {
+            if (fs == NULL) return;
+            for (FaceList::iterator itr = fs->begin(); itr != fs->end(); itr++)
+                Add(*itr);
+            bytes += sizeof(FaceSet);
+        }
+
+        void Add(const FacePtr& face) {
+            if (!face) return;
+            float v[9], lo[3], hi[3];
+            CollisionTest::Load(face, v);
+            CollisionTest::Bounds(v, lo, hi);
+            Box& b = stack.back();
+            for (unsigned int k = 0; k < 3; k++) {
+                b.lo[k] = std::min(b.lo[k], lo[k]);
+                b.hi[k] = std::max(b.hi[k], hi[k]);
+            }
+            references++;
+            bytes += sizeof(FacePtr);
+            if (faces.insert(face.get()).second) bytes += sizeof(Face);
+        }
+
+        void Push() {
+            Box b;
+            for (unsigned int k = 0; k < 3; k++) {
+                b.lo[k] = FLT_MAX;
+                b.hi[k] = -FLT_MAX;
+            }
+            stack.push_back(b);
+        }
+
+        Box Pop() {
+            Box b = stack.back();
+            stack.pop_back();
+            Box& parent = stack.back();
+            for (unsigned int k = 0; k < 3; k++) {
+                parent.lo[k] = std::min(parent.lo[k], b.lo[k]);
+                parent.hi[k] = std::max(parent.hi[k], b.hi[k]);
+            }
+            return b;
+        }
+
+        void VisitQuadNode(QuadNode* node) {
+            bytes += sizeof(QuadNode);
+            Push();
+            node->VisitSubNodes(*this);
+            quads[node] = Pop();
+        }
+
+        void VisitBSPNode(BSPNode* node) {
+            bytes += sizeof(BSPNode);
+            Push();
+            Add(node->GetDivider());
+            Add(node->GetSpan());
+            if (node->GetFront() != NULL) node->GetFront()->Accept(*this);
+            if (node->GetBack()  != NULL) node->GetBack()->Accept(*this);
+            Pop();
+        }
+
+        void VisitGeometryNode(GeometryNode* node) {
+            bytes += sizeof(GeometryNode);
+            Push();
+            Add(node->GetFaceSet());
+            node->VisitSubNodes(*this);
+            Pop();
+        }
+    };
+
+    ISceneNode& root;
+    std::map<ISceneNode*, Box> quads;
+    unsigned long bytes;
+    unsigned int references;
+
+    // the running query
+    bool ray;
+    float lo[3], hi[3];
+    float o[3], d[3], t;
+    unsigned int count;
+
+    void Test(const FacePtr& face) {
+        if (!face) return;
+        float v[9];
+        CollisionTest::Load(face, v);
+        if (ray) {
+            CollisionTest::Ray(o, d, v, t);
+        } else {
+            float tlo[3], thi[3];
+            CollisionTest::Bounds(v, tlo, thi);
+            if (CollisionTest::Overlap(tlo, thi, lo, hi)) count++;
+        }
+    }
+
+    void Test(FaceSet* fs) {
+        if (fs == NULL) return;
+        for (FaceList::iterator itr = fs->begin(); itr != fs->end(); itr++)
+            Test(*itr);
+    }
+
+public:
+    QuadBSPQuery(ISceneNode& root) : root(root) {
+        Measure m(quads);
+        m.Push();
+        root.Accept(m);
+        bytes = m.bytes;
+        references = m.references;
+    }
+
+    // Bytes of the tree nodes, face references and distinct faces.
+    unsigned long GetBytes() const { return bytes; }
+    unsigned int GetFaceReferences() const { return references; }
+
+    unsigned int Overlaps(const float* lo, const float* hi) {
+        ray = false;
+        std::copy(lo, lo + 3, this->lo);
+        std::copy(hi, hi + 3, this->hi);
+        count = 0;
+        root.Accept(*this);
+        return count;
+    }
+
+    float Ray(const float* o, const float* d, float t) {
+        ray = true;
+        for (unsigned int k = 0; k < 3; k++) {
+            this->o[k] = o[k];
+            this->d[k] = d[k];
+            // the bounds of the segment, for the quad nodes
+            lo[k] = std::min(o[k], o[k] + d[k] * t);
+            hi[k] = std::max(o[k], o[k] + d[k] * t);
+        }
+        this->t = t;
+        root.Accept(*this);
+        return this->t;
+    }
+
+    void VisitQuadNode(QuadNode* node) {
+        std::map<ISceneNode*, Box>::iterator b = quads.find(node);
+        if (b != quads.end() && !CollisionTest::Overlap(b->second.lo, b->second.hi, lo, hi))
+            return;
+        node->VisitSubNodes(*this);
+    }
+
+    void VisitBSPNode(BSPNode* node) {
+        FacePtr divider = node->GetDivider();
+        Test(divider);
+        Test(node->GetSpan());
+        if (!divider) {
+            node->VisitSubNodes(*this);
+            return;
+        }
+
+        // the sides of the divider plane the query reaches
+        float v[9], n[3];
+        CollisionTest::Load(divider, v);
+        float e1[3] = { v[3]-v[0], v[4]-v[1], v[5]-v[2] };
+        float e2[3] = { v[6]-v[0], v[7]-v[1], v[8]-v[2] };
+        n[0] = e1[1]*e2[2] - e1[2]*e2[1];
+        n[1] = e1[2]*e2[0] - e1[0]*e2[2];
+        n[2] = e1[0]*e2[1] - e1[1]*e2[0];
+        float offset = n[0]*v[0] + n[1]*v[1] + n[2]*v[2];
+        float a, b;
+        if (ray) {
+            a = n[0]*o[0] + n[1]*o[1] + n[2]*o[2] - offset;
+            b = a + (n[0]*d[0] + n[1]*d[1] + n[2]*d[2]) * t;
+        } else {
+            float c = 0.0f, r = 0.0f;
+            for (unsigned int k = 0; k < 3; k++) {
+                c += n[k] * (lo[k] + hi[k]) * 0.5f;
+                r += std::fabs(n[k]) * (hi[k] - lo[k]) * 0.5f;
+            }
+            a = c - offset - r;
+            b = c - offset + r;
+        }
+        bool front = (a >= 0.0f || b >= 0.0f);
+        bool back  = (a <= 0.0f || b <= 0.0f);
+        if (front && node->GetFront() != NULL) node->GetFront()->Accept(*this);
+        if (back  && node->GetBack()  != NULL) node->GetBack()->Accept(*this);
+    }
+
+    void VisitGeometryNode(GeometryNode* node) {
+        Test(node->GetFaceSet());
+        node->VisitSubNodes(*this);
+    }
+};
+
+#endif
@@ -0,0 +1,246 @@
+#ifndef _COMPOSITION_
+#define _COMPOSITION_
+
+#include <Meta/OpenGL.h>
+#include <Core/IEngine.h>
+#include <Core/IListener.h>
+#include <Display/ICanvas.h>
+#include <Display/ICanvasBackend.h>
+#include <Display/IFrame.h>
+#include <Resources/ITexture2D.h>
+#include <Resources/Texture2D.h>
+#include <Utils/Timer.h>
+#include <Logging/Logger.h>
+
+#include <vector>
+
+using OpenEngine::Core::IEngine;
+using OpenEngine::Core::IListener;
+using OpenEngine::Display::ICanvas;
+using OpenEngine::Display::ICanvasBackend;
+using OpenEngine::Display::IFrame;
+using OpenEngine::Resources::ITexture2DPtr;
+using OpenEngine::Resources::Texture2D;
+using OpenEngine::Utils::Timer;
+
+namespace display = OpenEngine::Display;
+
+/**
+ * The backend of a composite canvas: one texture the size of the
+ * frame that the views copy into. It does no copying of its own.
+ */
+class SharedTarget : public ICanvasBackend {
+private:
+    ITexture2DPtr texture;
+    unsigned int width, height;
+
+    void Allocate() {
+        GLuint id = texture->GetID();
+        glBindTexture(GL_TEXTURE_2D, id);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0,
+                     GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+
+public:
+    SharedTarget() : width(0), height(0) {}
+
+    unsigned int GetWidth() const { return width; }
+    unsigned int GetHeight() const { return height; }
+
+    void Create(unsigned int width, unsigned int height) {
+        this->width = width;
+        this->height = height;
+        // The pixels only live on the card, so the texture gets no
+        // buffer of its own; Init creates and allocates the GL texture.
+        texture = ITexture2DPtr(new Texture2D<unsigned char>(width, height, 4, NULL));
+    }
+
+    void Init(unsigned int width, unsigned int height) {
+        this->width = width;
+        this->height = height;
+        GLuint id;
+        glGenTextures(1, &id);
+        glBindTexture(GL_TEXTURE_2D, id);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        texture->SetID(id);
+        Allocate();
+    }
+
+    void Deinit() {
+        GLuint id = texture->GetID();
+        glDeleteTextures(1, &id);
+    }
+
+    void Resize(unsigned int width, unsigned int height) {
+        this->width = width;
+        this->height = height;
+        Allocate();
+    }
+
+    void Pre() {}
+    void Post() {}
+
+    ITexture2DPtr GetTexture() { return texture; }
+
+    ICanvasBackend* Clone() { return new SharedTarget(); }
+};
+
+/**
+ * The backend of one view of a composite canvas. After the view has
+ * been rendered it is copied straight into its region of the shared
+ * target, instead of into a texture of its own that a split screen
+ * canvas then draws and copies again.
+ */
+class RegionCopy : public ICanvasBackend {
+private:
+    SharedTarget& target;
+    float left, bottom; // fractions of the target
+    unsigned int width, height;
+
+public:
+    RegionCopy(SharedTarget& target, float left, float bottom)
+        : target(target), left(left), bottom(bottom), width(0), height(0) {}
+
+    void Create(unsigned int width, unsigned int height) {
+        this->width = width;
+        this->height = height;
+    }
+    void Init(unsigned int width, unsigned int height) { Create(width, height); }
+    void Deinit() {}
+    void Resize(unsigned int width, unsigned int height) { Create(width, height); }
+
+    void Pre() {
+        glViewport(0, 0, width, height);
+    }
+
+    void Post() {
+        glBindTexture(GL_TEXTURE_2D, target.GetTexture()->GetID());
+        glCopyTexSubImage2D(GL_TEXTURE_2D, 0,
+                            (GLint)(left * target.GetWidth()),
+                            (GLint)(bottom * target.GetHeight()),
+                            0, 0, width, height);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+
+    ITexture2DPtr GetTexture() { return target.GetTexture(); }
+
+    ICanvasBackend* Clone() { return new RegionCopy(target, left, bottom); }
+};
+
+/**
+ * Renders several views into their regions of one shared target, in
+ * place of a tree of split screen canvases. Each view must have a
+ * RegionCopy backend on the same target and region.
+ */
+class CompositeCanvas : public ICanvas {
+private:
+    struct Region {
+        ICanvas* canvas;
+        float width, height; // fractions of the target
+    };
+
+    SharedTarget* target;
+    std::vector<Region> regions;
+    unsigned int width, height;
+
+    void Layout() {
+        for (unsigned int i = 0; i < regions.size(); i++) {
+            regions[i].canvas->SetWidth((unsigned int)(regions[i].width * width));
+            regions[i].canvas->SetHeight((unsigned int)(regions[i].height * height));
+        }
+    }
+
+public:
+    CompositeCanvas(SharedTarget* target)
+        : ICanvas(target), target(target), width(0), height(0) {}
+
+    void Add(ICanvas& canvas, float width, float height) {
+        Region r;
+        r.canvas = &canvas;
+        r.width = width;
+        r.height = height;
+        regions.push_back(r);
+    }
+
+    void Handle(display::InitializeEventArg arg) {
+        target->Create(width, height);
+        target->Init(width, height);
+        Layout();
+        for (unsigned int i = 0; i < regions.size(); i++)
+            regions[i].canvas->Handle(display::InitializeEventArg(*regions[i].canvas));
+    }
+
+    void Handle(display::ProcessEventArg arg) {
+        for (unsigned int i = 0; i < regions.size(); i++)
+            regions[i].canvas->Handle(display::ProcessEventArg(*regions[i].canvas,
+                                                               arg.start, arg.approx));
+    }
+
+    void Handle(display::ResizeEventArg arg) {
+        target->Resize(width, height);
+        Layout();
+        for (unsigned int i = 0; i < regions.size(); i++)
+            regions[i].canvas->Handle(display::ResizeEventArg(*regions[i].canvas));
+    }
+
+    void Handle(display::DeinitializeEventArg arg) {
+        for (unsigned int i = 0; i < regions.size(); i++)
+            regions[i].canvas->Handle(display::DeinitializeEventArg(*regions[i].canvas));
+        target->Deinit();
+    }
+
+    unsigned int GetWidth() const { return width; }
+    unsigned int GetHeight() const { return height; }
+    void SetWidth(const unsigned int width) { this->width = width; }
+    void SetHeight(const unsigned int height) { this->height = height; }
+
+    ITexture2DPtr GetTexture() { return target->GetTexture(); }
+};
+
+/**
+ * Times a fixed number of frames and stops the engine. The copy
+ * traffic is estimated from the frame size: the split screen chain
+ * copies every pixel three times per frame (the views, the two halves
+ * and the frame canvas) and draws two of those copies again as
+ * textures, direct composition copies every pixel once.
+ */
+class FrameBenchmark : public IListener<OpenEngine::Core::ProcessEventArg> {
+private:
+    IEngine& engine;
+    IFrame& frame;
+    unsigned int frames, count, warmup;
+    bool direct;
+    Timer timer;
+    double total, slowest;
+
+public:
+    FrameBenchmark(IEngine& engine, IFrame& frame, unsigned int frames, bool direct)
+        : engine(engine), frame(frame), frames(frames), count(0)
+        , warmup(10), direct(direct), total(0), slowest(0) {}
+
+    void Handle(OpenEngine::Core::ProcessEventArg arg) {
+        if (count++ < warmup) {
+            timer.Start();
+            return;
+        }
+        double usec = timer.GetElapsedTimeAndReset().AsInt();
+        total += usec;
+        if (usec > slowest) slowest = usec;
+        if (count < warmup + frames) return;
+
+        double pixels = (double)frame.GetWidth() * frame.GetHeight();
+        double copies = direct ? 1 : 3;
+        logger.info << "Frame benchmark (" << (direct ? "direct" : "split screen")
+                    << " composition): " << frames << " frames, "
+                    << total / frames / 1000.0 << " ms average, "
+                    << slowest / 1000.0 << " ms slowest, "
+                    << pixels * copies * 4 / (1024 * 1024)
+                    << " MB copied per frame (estimated)" << logger.end;
+        engine.Stop();
+    }
+};
+
+#endif
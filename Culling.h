@@ -0,0 +1,223 @@
+#ifndef _CULLING_
+#define _CULLING_
+
+#include <Core/IListener.h>
+#include <Core/IModule.h>
+#include <Display/IViewingVolume.h>
+#include <Scene/ISceneNode.h>
+#include <Scene/ISceneNodeVisitor.h>
+#include <Scene/SceneNode.h>
+#include <Scene/GeometryNode.h>
+#include <Geometry/Face.h>
+#include <Geometry/FaceSet.h>
+#include <Math/Vector.h>
+#include <Logging/Logger.h>
+
+#include "Views.h"
+
+#include <algorithm>
+#include <vector>
+#include <cfloat>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define CULLING_SSE
+#endif
+
+using OpenEngine::Core::IListener;
+using OpenEngine::Core::ProcessEventArg;
+using OpenEngine::Core::DeinitializeEventArg;
+using OpenEngine::Display::IViewingVolume;
+using OpenEngine::Scene::ISceneNode;
+using OpenEngine::Scene::ISceneNodeVisitor;
+using OpenEngine::Scene::SceneNode;
+using OpenEngine::Scene::GeometryNode;
+using OpenEngine::Geometry::FaceSet;
+using OpenEngine::Geometry::FaceList;
+using OpenEngine::Math::Vector;
+
+class CullingPass;
+
+/**
+ * A node that only visits its sub nodes when they are visible in the
+ * view being rendered. Outside of rendering all sub nodes are visited,
+ * so transformers and other visitors see the whole scene.
+ */
+class CullNode : public SceneNode {
+private:
+    CullingPass& pass;
+    unsigned int index;
+
+public:
+    CullNode(CullingPass& pass, unsigned int index)
+        : pass(pass), index(index) {}
+
+    void VisitSubNodes(ISceneNodeVisitor& visitor);
+};
+
+/**
+ * Frustum culling of the static scene for several views at once.
+ *
+ * Build wraps every geometry node of the partitioned static scene in a
+ * CullNode and records its bounding box in flat arrays. Once per frame,
+ * when the first view starts rendering, every box is tested against
+ * the frusta of all views in one pass over those arrays, four boxes at
+ * a time with SSE where available. Each view then only draws the
+ * boxes that intersect its frustum.
+ *
+ * The view being rendered is selected by a ViewBackend around the
+ * backend of each canvas, see CreateBackend.
+ */
+class CullingPass : public IListener<ProcessEventArg>,
+                    public IListener<DeinitializeEventArg>,
+                    public IViewListener {
+private:
+    // bounding boxes of the cull nodes
+    std::vector<float> minX, minY, minZ, maxX, maxY, maxZ;
+    unsigned int count;
+
+    std::vector<IViewingVolume*> views;
+    std::vector<unsigned char> visible; // bit v set: visible in view v
+    int active;
+    bool dirty;
+
+    unsigned long frames, tested;
+    std::vector<unsigned long> drawn;
+
+    class Collector : public ISceneNodeVisitor {
+    public:
+        std::vector<GeometryNode*> nodes;
+        void VisitGeometryNode(GeometryNode* node) {
+            nodes.push_back(node);
+        }
+    };
+
+    // Clear bit of every box that is completely outside the plane.
+    void TestPlane(const float p[4], unsigned char bit) {
+        unsigned int n = minX.size();
+        unsigned int i = 0;
+#ifdef CULLING_SSE
+        __m128 a = _mm_set1_ps(p[0]), b = _mm_set1_ps(p[1]);
+        __m128 c = _mm_set1_ps(p[2]), d = _mm_set1_ps(p[3]);
+        __m128 zero = _mm_setzero_ps();
+        for (; i + 4 <= n; i += 4) {
+            __m128 x = _mm_max_ps(_mm_mul_ps(a, _mm_loadu_ps(&minX[i])),
+                                  _mm_mul_ps(a, _mm_loadu_ps(&maxX[i])));
+            __m128 y = _mm_max_ps(_mm_mul_ps(b, _mm_loadu_ps(&minY[i])),
+                                  _mm_mul_ps(b, _mm_loadu_ps(&maxY[i])));
+            __m128 z = _mm_max_ps(_mm_mul_ps(c, _mm_loadu_ps(&minZ[i])),
+                                  _mm_mul_ps(c, _mm_loadu_ps(&maxZ[i])));
+            __m128 dist = _mm_add_ps(_mm_add_ps(x, y), _mm_add_ps(z, d));
+            int outside = _mm_movemask_ps(_mm_cmplt_ps(dist, zero));
+            if (outside & 1) visible[i]   &= ~bit;
+            if (outside & 2) visible[i+1] &= ~bit;
+            if (outside & 4) visible[i+2] &= ~bit;
+            if (outside & 8) visible[i+3] &= ~bit;
+        }
+#endif
+        for (; i < n; i++) {
+            float x = std::max(p[0] * minX[i], p[0] * maxX[i]);
+            float y = std::max(p[1] * minY[i], p[1] * maxY[i]);
+            float z = std::max(p[2] * minZ[i], p[2] * maxZ[i]);
+            if (x + y + z + p[3] < 0) visible[i] &= ~bit;
+        }
+    }
+
+    void Update() {
+        std::fill(visible.begin(), visible.end(), (unsigned char)((1 << views.size()) - 1));
+        for (unsigned int v = 0; v < views.size(); v++) {
+            float planes[6][4];
+            GetFrustumPlanes(*views[v], planes);
+            for (unsigned int p = 0; p < 6; p++)
+                TestPlane(planes[p], 1 << v);
+        }
+        for (unsigned int v = 0; v < views.size(); v++)
+            for (unsigned int i = 0; i < count; i++)
+                if (visible[i] & (1 << v)) drawn[v]++;
+        tested += count;
+        frames++;
+        dirty = false;
+    }
+
+public:
+    CullingPass()
+        : count(0), active(-1), dirty(true), frames(0), tested(0) {}
+
+    /**
+     * Wrap the geometry nodes below root in cull nodes. Must run before
+     * the geometry is converted to vertex arrays.
+     */
+    void Build(ISceneNode& root) {
+        Collector c;
+        root.Accept(c);
+        for (unsigned int i = 0; i < c.nodes.size(); i++) {
+            GeometryNode* geom = c.nodes[i];
+            ISceneNode* parent = geom->GetParent();
+            if (parent == NULL) continue;
+
+            float lo[3] = {  FLT_MAX,  FLT_MAX,  FLT_MAX };
+            float hi[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+            FaceSet* fs = geom->GetFaceSet();
+            for (FaceList::iterator itr = fs->begin(); itr != fs->end(); itr++)
+                for (unsigned int v = 0; v < 3; v++)
+                    for (unsigned int k = 0; k < 3; k++) {
+                        lo[k] = std::min(lo[k], (*itr)->vert[v][k]);
+                        hi[k] = std::max(hi[k], (*itr)->vert[v][k]);
+                    }
+            if (lo[0] > hi[0]) continue;
+
+            CullNode* cull = new CullNode(*this, count++);
+            parent->RemoveNode(geom);
+            cull->AddNode(geom);
+            parent->AddNode(cull);
+            minX.push_back(lo[0]); minY.push_back(lo[1]); minZ.push_back(lo[2]);
+            maxX.push_back(hi[0]); maxY.push_back(hi[1]); maxZ.push_back(hi[2]);
+        }
+        visible.resize(count, 0xFF);
+        logger.info << "Culling " << count << " static nodes" << logger.end;
+    }
+
+    /**
+     * Add a view, at most eight. Returns the view index.
+     */
+    unsigned int AddView(IViewingVolume* view) {
+        views.push_back(view);
+        drawn.push_back(0);
+        return views.size() - 1;
+    }
+
+    /**
+     * Wrap the backend of the canvas rendering the given view.
+     */
+    ICanvasBackend* CreateBackend(ICanvasBackend* backend, unsigned int view) {
+        return new ViewBackend(backend, *this, view);
+    }
+
+    void BeginView(unsigned int view) {
+        if (dirty) Update();
+        active = view;
+    }
+
+    void EndView() { active = -1; }
+
+    bool IsVisible(unsigned int index) const {
+        return active < 0 || (visible[index] & (1 << active));
+    }
+
+    // A new frame starts, test again at the first view.
+    void Handle(ProcessEventArg arg) { dirty = true; }
+
+    void Handle(DeinitializeEventArg arg) {
+        if (frames == 0 || count == 0) return;
+        for (unsigned int v = 0; v < views.size(); v++)
+            logger.info << "Culling view " << v << ": "
+                        << 100.0 * drawn[v] / tested
+                        << "% of the static nodes drawn" << logger.end;
+    }
+};
+
+inline void CullNode::VisitSubNodes(ISceneNodeVisitor& visitor) {
+    if (pass.IsVisible(index)) SceneNode::VisitSubNodes(visitor);
+}
+
+#endif
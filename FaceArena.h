@@ -0,0 +1,195 @@
+#ifndef _FACE_ARENA_
+#define _FACE_ARENA_
+
+#include <Scene/ISceneNode.h>
+#include <Scene/ISceneNodeVisitor.h>
+#include <Scene/GeometryNode.h>
+#include <Scene/BSPNode.h>
+#include <Geometry/Face.h>
+#include <Geometry/FaceSet.h>
+#include <Utils/Timer.h>
+#include <Logging/Logger.h>
+
+#include "AllocationCounter.h"
+
+#include <map>
+#include <new>
+#include <string>
+#include <vector>
+
+using OpenEngine::Scene::ISceneNode;
+using OpenEngine::Scene::ISceneNodeVisitor;
+using OpenEngine::Scene::GeometryNode;
+using OpenEngine::Scene::BSPNode;
+using OpenEngine::Geometry::Face;
+using OpenEngine::Geometry::FacePtr;
+using OpenEngine::Geometry::FaceSet;
+using OpenEngine::Geometry::FaceList;
+using OpenEngine::Utils::Timer;
+
+/**
+ * Moves the faces of scenes into one contiguous block per scene, in
+ * traversal order.
+ *
+ * Loading and the transformers allocate every face on its own, so the
+ * faces of a leaf end up scattered over the heap. Compact copies them
+ * into an array and points the face sets of the geometry nodes and
+ * the spans of the BSP nodes at the copies. All pointers into a block
+ * share the reference count of the block, so it costs two allocations
+ * and is freed at once when its last face is released.
+ *
+ * Faces shared between the scenes, such as the shared models of the
+ * static and physics scenes, stay shared: they are moved into the
+ * block of the first scene that references them.
+ *
+ * The divider faces of BSP nodes are not moved, only their spans. A
+ * scene must not be transformed afterwards, or the blocks are
+ * scattered again.
+ */
+class FaceArena : public ISceneNodeVisitor {
+private:
+    // Destroys the faces of a block and frees it.
+    struct Destroy {
+        unsigned int count;
+        Destroy(unsigned int count) : count(count) {}
+        void operator()(Face* faces) {
+            for (unsigned int i = 0; i < count; i++)
+                faces[i].~Face();
+            ::operator delete(faces);
+        }
+    };
+
+    std::vector<std::string> names;
+    std::vector<ISceneNode*> scenes;
+    std::map<Face*, FacePtr> moved;
+    std::vector<FacePtr> order;
+    bool rewrite;
+    bool timed;
+    double checksum; // keeps the timed traversals from being optimized away
+
+    void Visit(FaceSet* fs) {
+        if (fs == NULL) return;
+        for (FaceList::iterator itr = fs->begin(); itr != fs->end(); itr++) {
+            if (rewrite) {
+                std::map<Face*, FacePtr>::iterator m = moved.find(itr->get());
+                if (m != moved.end()) *itr = m->second;
+            }
+            else if (moved.find(itr->get()) == moved.end()) {
+                moved[itr->get()] = FacePtr();
+                order.push_back(*itr);
+            }
+        }
+    }
+
+    // Reads the vertices of every face, as the collision and vertex
+    // array passes do.
+    class Walk : public ISceneNodeVisitor {
+    public:
+        double sum;
+        Walk() : sum(0) {}
+        void Add(FaceSet* fs) {
+            if (fs == NULL) return;
+            for (FaceList::iterator itr = fs->begin(); itr != fs->end(); itr++)
+                for (unsigned int c = 0; c < 3; c++)
+                    sum += (*itr)->vert[c][0] + (*itr)->vert[c][1] + (*itr)->vert[c][2];
+        }
+        void VisitGeometryNode(GeometryNode* node) {
+            Add(node->GetFaceSet());
+            node->VisitSubNodes(*this);
+        }
+        void VisitBSPNode(BSPNode* node) {
+            Add(node->GetSpan());
+            if (node->GetFront() != NULL) node->GetFront()->Accept(*this);
+            if (node->GetBack()  != NULL) node->GetBack()->Accept(*this);
+        }
+    };
+
+public:
+    /**
+     * When timed, Compact logs the traversal time of every scene
+     * before and after compacting it.
+     */
+    FaceArena(bool timed = false) : rewrite(false), timed(timed), checksum(0) {}
+
+    void Add(std::string name, ISceneNode* scene) {
+        if (scene == NULL) return;
+        names.push_back(name);
+        scenes.push_back(scene);
+    }
+
+    /**
+     * Microseconds to read the vertices of all faces of a scene, the
+     * best of a few runs.
+     */
+    double TimeTraversal(ISceneNode& scene, unsigned int runs = 5) {
+        double best = 0;
+        for (unsigned int i = 0; i < runs; i++) {
+            Walk walk;
+            Timer timer;
+            timer.Start();
+            scene.Accept(walk);
+            double usec = timer.GetElapsedTime().AsInt();
+            checksum += walk.sum;
+            if (i == 0 || usec < best) best = usec;
+        }
+        return best;
+    }
+
+    void Compact() {
+        moved.clear();
+        for (unsigned int s = 0; s < scenes.size(); s++) {
+            double before = timed ? TimeTraversal(*scenes[s]) : 0;
+            unsigned long allocations = GetAllocationCount();
+
+            order.clear();
+            rewrite = false;
+            scenes[s]->Accept(*this);
+            unsigned int count = order.size();
+            if (count > 0) {
+                Face* block = static_cast<Face*>(::operator new(count * sizeof(Face)));
+                unsigned int built = 0;
+                try {
+                    for (; built < count; built++)
+                        new (block + built) Face(*order[built]);
+                } catch (...) {
+                    Destroy destroy(built);
+                    destroy(block);
+                    throw;
+                }
+                FacePtr owner(block, Destroy(count));
+                for (unsigned int i = 0; i < count; i++)
+                    moved[order[i].get()] = FacePtr(owner, block + i);
+            }
+            order.clear();
+
+            // shared faces of earlier scenes are rewritten too
+            rewrite = true;
+            scenes[s]->Accept(*this);
+            allocations = GetAllocationCount() - allocations;
+
+            logger.info << "Face arena " << names[s] << ": " << count
+                        << " faces moved into one block (" << allocations
+                        << " allocations while compacting)" << logger.end;
+            if (timed) {
+                double after = TimeTraversal(*scenes[s]);
+                logger.info << "Face arena " << names[s] << " traversal: "
+                            << before << " us -> " << after << " us" << logger.end;
+            }
+        }
+        // drop the references to the old faces
+        moved.clear();
+    }
+
+    void VisitGeometryNode(GeometryNode* node) {
+        Visit(node->GetFaceSet());
+        node->VisitSubNodes(*this);
+    }
+
+    void VisitBSPNode(BSPNode* node) {
+        Visit(node->GetSpan());
+        if (node->GetFront() != NULL) node->GetFront()->Accept(*this);
+        if (node->GetBack()  != NULL) node->GetBack()->Accept(*this);
+    }
+};
+
+#endif
@@ -0,0 +1,176 @@
+#ifndef _HEADLESS_SIMULATION_
+#define _HEADLESS_SIMULATION_
+
+#include <Core/IModule.h>
+#include <Physics/FixedTimeStepPhysics.h>
+#include <Physics/RigidBox.h>
+#include <Math/Matrix.h>
+#include <Utils/Timer.h>
+#include <Logging/Logger.h>
+
+#include "KeyboardHandler.h"
+#include "InputLog.h"
+#include "VehicleFleet.h"
+
+#include <vector>
+
+using OpenEngine::Core::IListener;
+using OpenEngine::Core::IModule;
+using OpenEngine::Core::InitializeEventArg;
+using OpenEngine::Core::ProcessEventArg;
+using OpenEngine::Core::DeinitializeEventArg;
+using OpenEngine::Physics::RigidBox;
+using OpenEngine::Physics::FixedTimeStepPhysics;
+using OpenEngine::Math::Matrix;
+using OpenEngine::Math::Vector;
+using OpenEngine::Utils::Timer;
+using OpenEngine::Utils::Time;
+
+/**
+ * Drives the physics without an engine, display or renderer.
+ *
+ * Every call to Step() advances the FixedTimeStepPhysics by exactly
+ * one of its fixed time steps, so the result of a run only depends on
+ * the scene, the number of ticks, the controllers and the optional
+ * input log. The fleet must use a fixed delta to be deterministic.
+ */
+class HeadlessSimulation {
+private:
+    FixedTimeStepPhysics& physics;
+    VehicleFleet& fleet;
+    KeyboardHandler* handler;
+    InputPlayer* player;
+    std::vector<IListener<ProcessEventArg>*> controllers;
+    unsigned int tick;
+
+public:
+    HeadlessSimulation(FixedTimeStepPhysics& physics, VehicleFleet& fleet)
+        : physics(physics)
+        , fleet(fleet)
+        , handler(NULL)
+        , player(NULL)
+        , tick(0)
+    {}
+
+    unsigned int GetTick() const { return tick; }
+
+    /**
+     * Apply the vehicle controls of a keyboard handler on every tick,
+     * optionally fed from a recorded input log.
+     */
+    void SetInput(KeyboardHandler* handler, InputPlayer* player) {
+        this->handler = handler;
+        this->player = player;
+    }
+
+    /**
+     * Add a controller, such as an AI driver, that sets fleet
+     * controls on every tick.
+     */
+    void AddController(IListener<ProcessEventArg>* controller) {
+        controllers.push_back(controller);
+    }
+
+    void Initialize() {
+        tick = 0;
+        physics.Handle(InitializeEventArg());
+        fleet.Handle(InitializeEventArg());
+        if (handler != NULL) handler->Handle(InitializeEventArg());
+    }
+
+    void Deinitialize() {
+        if (handler != NULL) handler->Handle(DeinitializeEventArg());
+        physics.Handle(DeinitializeEventArg());
+    }
+
+    void Step() {
+        ProcessEventArg arg(Time(), 0);
+        if (player != NULL) player->Feed(handler->GetTick());
+        if (handler != NULL) handler->Handle(arg);
+        for (unsigned int i = 0; i < controllers.size(); i++)
+            controllers[i]->Handle(arg);
+        fleet.Handle(arg);
+        physics.Handle(arg);
+        tick++;
+    }
+
+    /**
+     * Run the simulation for a fixed number of ticks and log the
+     * throughput and the final state of the first vehicle.
+     */
+    void Run(unsigned int ticks) {
+        Initialize();
+
+        Timer timer;
+        timer.Start();
+        for (unsigned int i = 0; i < ticks; i++)
+            Step();
+        double usec = timer.GetElapsedTime().AsInt();
+
+        logger.info << "Headless simulation: " << fleet.GetSize()
+                    << " vehicles, " << ticks << " ticks in "
+                    << usec / 1000.0 << " ms" << logger.end;
+        if (usec > 0) {
+            logger.info << "  steps/sec:    " << ticks * 1000000.0 / usec
+                        << logger.end;
+        }
+        if (ticks > 0) {
+            logger.info << "  ns per tick:  " << usec * 1000.0 / ticks
+                        << logger.end;
+        }
+        if (fleet.GetSize() > 0) {
+            RigidBox* box = fleet.GetBox(0);
+            Matrix<3,3,float> m(box->GetRotationMatrix());
+            logger.info << "  final center: " << box->GetCenter() << logger.end;
+            logger.info << "  final rotation: " << m << logger.end;
+        }
+
+        Deinitialize();
+    }
+};
+
+/**
+ * Steps a simulation from the engine at a fixed rate, the windowed
+ * counterpart of running it headless.
+ *
+ * On every process event the simulation is stepped as many times as
+ * physics ticks are due on the wall clock. Input, controllers and the
+ * fleet run once per tick, inside the step, so the input of a drive
+ * is stamped with and replayed at the same physics tick windowed and
+ * headless.
+ */
+class RealTimeSimulation : public IModule {
+private:
+    HeadlessSimulation& sim;
+    unsigned int rate;
+    unsigned int scheduled;
+    Timer timer;
+
+public:
+    RealTimeSimulation(HeadlessSimulation& sim, unsigned int rate = 100)
+        : sim(sim)
+        , rate(rate)
+        , scheduled(0)
+    {}
+
+    void Handle(InitializeEventArg arg) {
+        sim.Initialize();
+        scheduled = 0;
+        timer.Start();
+    }
+
+    void Handle(ProcessEventArg arg) {
+        double now = timer.GetElapsedTime().AsInt();
+        unsigned int due = (unsigned int)(now * rate / 1000000.0);
+        // do not try to catch up more than a quarter second
+        if (due - scheduled > rate / 4 + 1) scheduled = due - rate / 4 - 1;
+        for (; scheduled < due; scheduled++)
+            sim.Step();
+    }
+
+    void Handle(DeinitializeEventArg arg) {
+        sim.Deinitialize();
+    }
+};
+
+#endif
@@ -0,0 +1,194 @@
+#ifndef _INPUT_LOG_
+#define _INPUT_LOG_
+
+#include <Core/IListener.h>
+#include <Core/IModule.h>
+#include <Core/Exceptions.h>
+#include <Devices/IKeyboard.h>
+#include <Devices/IJoystick.h>
+#include <Logging/Logger.h>
+
+#include "KeyboardHandler.h"
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+using OpenEngine::Core::IListener;
+using OpenEngine::Core::Exception;
+using OpenEngine::Devices::KeyboardEventArg;
+using OpenEngine::Devices::JoystickAxisEventArg;
+using OpenEngine::Devices::Key;
+using OpenEngine::Devices::ModifierKey;
+using OpenEngine::Devices::KeyEventType;
+
+/**
+ * Binary input log.
+ *
+ * Layout (all integers little endian):
+ *   header: "OEIL", uint32 version
+ *   record: uint32 tick, uint8 kind, followed by
+ *           KEY:  uint8 type, uint32 sym, uint32 mod
+ *           AXIS: int16 axis[INPUT_LOG_AXES]
+ *
+ * The tick is the physics tick count of the KeyboardHandler at the
+ * time the event arrived, so the event takes effect in the following
+ * physics tick.
+ */
+static const char         INPUT_LOG_MAGIC[4] = {'O','E','I','L'};
+static const unsigned int INPUT_LOG_VERSION  = 1;
+static const unsigned int INPUT_LOG_AXES     = 2;
+
+struct InputRecord {
+    enum Kind { KEY = 0, AXIS = 1 };
+    unsigned int tick;
+    Kind kind;
+    KeyboardEventArg key;
+    int axis[INPUT_LOG_AXES];
+};
+
+namespace InputLogIO {
+    inline void WriteUInt(std::ostream& os, unsigned int v, unsigned int bytes) {
+        for (unsigned int i = 0; i < bytes; i++)
+            os.put((char)((v >> (8*i)) & 0xFF));
+    }
+    inline unsigned int ReadUInt(std::istream& is, unsigned int bytes) {
+        unsigned int v = 0;
+        for (unsigned int i = 0; i < bytes; i++)
+            v |= ((unsigned int)(unsigned char)is.get()) << (8*i);
+        return v;
+    }
+}
+
+/**
+ * Records every keyboard and joystick axis event into a binary log.
+ * Attach it to the same events as the KeyboardHandler it stamps its
+ * ticks from.
+ */
+class InputRecorder : public IListener<KeyboardEventArg>,
+                      public IListener<JoystickAxisEventArg> {
+private:
+    std::ofstream out;
+    KeyboardHandler& handler;
+    unsigned int count;
+
+public:
+    InputRecorder(std::string file, KeyboardHandler& handler)
+        : out(file.c_str(), std::ios::binary | std::ios::trunc)
+        , handler(handler)
+        , count(0)
+    {
+        if (!out.good())
+            throw Exception("Can not open input log for writing: " + file);
+        out.write(INPUT_LOG_MAGIC, 4);
+        InputLogIO::WriteUInt(out, INPUT_LOG_VERSION, 4);
+    }
+
+    ~InputRecorder() {
+        out.close();
+        logger.info << "Recorded " << count << " input events" << logger.end;
+    }
+
+    void Handle(KeyboardEventArg arg) {
+        InputLogIO::WriteUInt(out, handler.GetTick(), 4);
+        InputLogIO::WriteUInt(out, InputRecord::KEY, 1);
+        InputLogIO::WriteUInt(out, arg.type, 1);
+        InputLogIO::WriteUInt(out, arg.sym, 4);
+        InputLogIO::WriteUInt(out, arg.mod, 4);
+        out.flush();
+        count++;
+    }
+
+    void Handle(JoystickAxisEventArg arg) {
+        InputLogIO::WriteUInt(out, handler.GetTick(), 4);
+        InputLogIO::WriteUInt(out, InputRecord::AXIS, 1);
+        for (unsigned int i = 0; i < INPUT_LOG_AXES; i++)
+            InputLogIO::WriteUInt(out, (unsigned short)arg.state.axisState[i], 2);
+        out.flush();
+        count++;
+    }
+};
+
+/**
+ * Plays an input log back into a KeyboardHandler.
+ *
+ * The simulation feeds the player once per physics tick, ahead of the
+ * handler, so all events recorded for the handler's current tick are
+ * delivered before it sets the controls, exactly as during the
+ * recording.
+ */
+class InputPlayer {
+private:
+    std::vector<InputRecord> records;
+    unsigned int next;
+    KeyboardHandler& handler;
+
+public:
+    InputPlayer(std::string file, KeyboardHandler& handler)
+        : next(0)
+        , handler(handler)
+    {
+        std::ifstream in(file.c_str(), std::ios::binary);
+        char magic[4];
+        in.read(magic, 4);
+        if (!in.good() || std::string(magic, 4) != std::string(INPUT_LOG_MAGIC, 4))
+            throw Exception("Not an input log: " + file);
+        unsigned int version = InputLogIO::ReadUInt(in, 4);
+        if (version != INPUT_LOG_VERSION)
+            throw Exception("Unsupported input log version in: " + file);
+
+        while (in.peek() != EOF) {
+            InputRecord r;
+            r.tick = InputLogIO::ReadUInt(in, 4);
+            r.kind = (InputRecord::Kind)InputLogIO::ReadUInt(in, 1);
+            if (r.kind == InputRecord::KEY) {
+                r.key.type = (KeyEventType)InputLogIO::ReadUInt(in, 1);
+                r.key.sym  = (Key)InputLogIO::ReadUInt(in, 4);
+                r.key.mod  = (ModifierKey)InputLogIO::ReadUInt(in, 4);
+            } else {
+                for (unsigned int i = 0; i < INPUT_LOG_AXES; i++)
+                    r.axis[i] = (short)InputLogIO::ReadUInt(in, 2);
+            }
+            if (!in.good())
+                throw Exception("Truncated input log: " + file);
+            records.push_back(r);
+        }
+        logger.info << "Loaded " << records.size()
+                    << " input events from " << file << logger.end;
+    }
+
+    /**
+     * Play the records of another player into a different handler,
+     * without reading the log again.
+     */
+    InputPlayer(const InputPlayer& other, KeyboardHandler& handler)
+        : records(other.records)
+        , next(0)
+        , handler(handler)
+    {}
+
+    bool Done() const { return next >= records.size(); }
+
+    unsigned int GetLastTick() const {
+        return records.empty() ? 0 : records.back().tick;
+    }
+
+    /**
+     * Deliver every event stamped with the given tick.
+     */
+    void Feed(unsigned int tick) {
+        while (next < records.size() && records[next].tick <= tick) {
+            const InputRecord& r = records[next++];
+            if (r.kind == InputRecord::KEY) {
+                handler.Handle(r.key);
+            } else {
+                JoystickAxisEventArg arg;
+                for (unsigned int i = 0; i < INPUT_LOG_AXES; i++)
+                    arg.state.axisState[i] = r.axis[i];
+                handler.Handle(arg);
+            }
+        }
+    }
+};
+
+#endif
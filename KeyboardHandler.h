@@ -9,7 +9,8 @@
 #include <Physics/FixedTimeStepPhysics.h>
 #include <Physics/RigidBox.h>
 #include <Math/Matrix.h>
-#include <Utils/Timer.h>
+
+#include "VehicleFleet.h"
 
 using OpenEngine::Core::IModule;
 using OpenEngine::Core::IListener;
@@ -21,8 +22,6 @@ using OpenEngine::Devices::KeyboardEventArg;
 using OpenEngine::Display::Camera;
 using OpenEngine::Physics::RigidBox;
 using OpenEngine::Physics::FixedTimeStepPhysics;
-using OpenEngine::Math::Matrix;
-using OpenEngine::Utils::Timer;
 
 namespace keys = OpenEngine::Devices;
 
@@ -34,14 +33,24 @@ private:
     bool mod;
     float step;
     Camera* camera;
+    IVehicleControl* control;
+    unsigned int slot;
     RigidBox* box;
     FixedTimeStepPhysics* physics;
     IEngine& engine;
-    Timer timer;
+    unsigned int tick;
 
 public:
+    /**
+     * Control vehicle number slot of the fleet. The fleet computes and
+     * applies the forces, the handler only sets the controls. Reset
+     * and pause need the box and the physics; pass NULL to disable
+     * them.
+     */
     KeyboardHandler(IEngine& engine,
                     Camera* camera,
+                    IVehicleControl* control,
+                    unsigned int slot,
                     RigidBox* box,
                     FixedTimeStepPhysics* physics)
         : up(0)
@@ -49,59 +58,29 @@ public:
         , left(0)
         , right(0)
         , camera(camera)
+        , control(control)
+        , slot(slot)
         , box(box)
         , physics(physics)
         , engine(engine)
+        , tick(0)
     {}
 
+    /**
+     * Number of process events handled so far. The simulation hands
+     * the handler one process event per physics tick, so this is the
+     * physics tick input events are stamped with when recorded.
+     */
+    unsigned int GetTick() const { return tick; }
+
     void Handle(Core::InitializeEventArg arg) {
         step = 0.0f;
-        timer.Start();
+        tick = 0;
     }
     void Handle(Core::DeinitializeEventArg arg) {}
     void Handle(Core::ProcessEventArg arg) {
-
-
-        float delta = (float) timer.GetElapsedTimeAndReset().AsInt() / 100000;
-
-        if (box == NULL || !( up || down || left || right )) return;
-
-        static float speed = 1750.0f;
-        static float turn = 550.0f;
-        Matrix<3,3,float> m(box->GetRotationMatrix());
-
-        
-
-        // Forward 
-        if( up > 0.0 ){
-            
-            Vector<3,float> dir = m.GetRow(0) * delta;
-            float sp = speed * up;
-            box->AddForce(dir * sp, 1);
-            box->AddForce(dir * sp, 2);
-            box->AddForce(dir * sp, 3);
-            box->AddForce(dir * sp, 4);
-        }
-        if( down > 0.0){
-            Vector<3,float> dir = -m.GetRow(0) * delta;
-            float sp = speed * down;
-            box->AddForce(dir * sp, 5);
-            box->AddForce(dir * sp, 6);
-            box->AddForce(dir * sp, 7);
-            box->AddForce(dir * sp, 8);
-        }
-        if( left > 0.0 ){
-            Vector<3,float> dir = -m.GetRow(2) * delta;
-            float tu = turn * left;
-            box->AddForce(dir * tu, 2);
-            box->AddForce(dir * tu, 4);
-        }
-        if( right > 0.0) {
-            Vector<3,float> dir = m.GetRow(2) * delta;
-            float tu = turn * right;
-            box->AddForce(dir * tu, 1);
-            box->AddForce(dir * tu, 3);
-        }
+        tick++;
+        if (control != NULL) control->SetControl(slot, up, down, left, right);
     }
 
     void Handle(KeyboardEventArg arg) {
@@ -128,8 +107,8 @@ public:
 
         switch ( arg.sym ) {
         case keys::KEY_r: {
-            physics->Handle(Core::InitializeEventArg());
             if( physics != NULL ){
+                physics->Handle(Core::InitializeEventArg());
                 if( box != NULL ) {
                     box->ResetForces();
                     box->SetCenter( Vector<3,float>(2, 1, 2) );
@@ -153,6 +132,7 @@ public:
 
         // Log Camera position 
         case keys::KEY_c: {
+            if (camera == NULL) break;
             Vector<3,float> camPos = camera->GetPosition();
             logger.info << "Camera Position: " << camPos << logger.end;
             break;
@@ -0,0 +1,279 @@
+#ifndef _LEVEL_OF_DETAIL_
+#define _LEVEL_OF_DETAIL_
+
+#include <Display/IViewingVolume.h>
+#include <Scene/ISceneNode.h>
+#include <Scene/ISceneNodeVisitor.h>
+#include <Scene/SceneNode.h>
+#include <Scene/GeometryNode.h>
+#include <Geometry/Face.h>
+#include <Geometry/FaceSet.h>
+#include <Math/Matrix.h>
+#include <Math/Vector.h>
+#include <Logging/Logger.h>
+
+#include "Views.h"
+#include "WorkerPool.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <set>
+#include <vector>
+
+using OpenEngine::Display::IViewingVolume;
+using OpenEngine::Scene::ISceneNode;
+using OpenEngine::Scene::ISceneNodeVisitor;
+using OpenEngine::Scene::SceneNode;
+using OpenEngine::Scene::GeometryNode;
+using OpenEngine::Geometry::Face;
+using OpenEngine::Geometry::FacePtr;
+using OpenEngine::Geometry::FaceSet;
+using OpenEngine::Geometry::FaceList;
+using OpenEngine::Math::Matrix;
+using OpenEngine::Math::Vector;
+
+/**
+ * Chooses the level of detail of objects for the view being rendered
+ * from their projected size, the bounding sphere radius relative to
+ * the height of the view. Level 0 is full detail, each threshold the
+ * projected size below which the next level is used.
+ */
+class LODSelector : public IViewListener {
+private:
+    std::vector<IViewingVolume*> views;
+    std::vector<float> thresholds;
+    int active;
+    Vector<3,float> position;
+    float scale;
+
+public:
+    LODSelector() : active(-1), scale(1.0f) {}
+
+    unsigned int AddView(IViewingVolume* view) {
+        views.push_back(view);
+        return views.size() - 1;
+    }
+
+    void SetThresholds(std::vector<float> thresholds) {
+        this->thresholds = thresholds;
+    }
+
+    void BeginView(unsigned int view) {
+        active = view;
+        position = views[view]->GetPosition();
+        Matrix<4,4,float> projection = views[view]->GetProjectionMatrix();
+        scale = projection(1,1);
+    }
+
+    void EndView() { active = -1; }
+
+    /**
+     * The level to draw, or -1 outside of rendering when every level
+     * should be visited.
+     */
+    int Select(Vector<3,float> center, float radius, unsigned int levels) {
+        if (active < 0) return -1;
+        float distance = (center - position).GetLength();
+        if (distance <= radius) return 0;
+        float size = radius * scale / distance;
+        unsigned int level = 0;
+        while (level + 1 < levels && level < thresholds.size() &&
+               size < thresholds[level])
+            level++;
+        return level;
+    }
+};
+
+/**
+ * Holds the levels of detail of one object as LevelNode children.
+ */
+class LODNode : public SceneNode {
+private:
+    LODSelector& selector;
+    Vector<3,float> center;
+    float radius;
+    unsigned int levels;
+
+public:
+    LODNode(LODSelector& selector, Vector<3,float> center, float radius,
+            unsigned int levels)
+        : selector(selector), center(center), radius(radius), levels(levels) {}
+
+    int Select() { return selector.Select(center, radius, levels); }
+};
+
+/**
+ * One level of an LODNode, visited only when it is selected.
+ */
+class LevelNode : public SceneNode {
+private:
+    LODNode& lod;
+    int level;
+
+public:
+    LevelNode(LODNode& lod, int level) : lod(lod), level(level) {}
+
+    void VisitSubNodes(ISceneNodeVisitor& visitor) {
+        int selected = lod.Select();
+        if (selected < 0 || selected == level)
+            SceneNode::VisitSubNodes(visitor);
+    }
+};
+
+/**
+ * Generates coarser levels of the geometry nodes of a scene by vertex
+ * clustering and replaces each node by an LODNode.
+ *
+ * Vertices are snapped to the centers of a world aligned grid, whose
+ * cells are four times larger for every level. Faces that collapse or
+ * turn over are dropped, as are faces snapped onto one already kept,
+ * and the rest get flat normals of their snapped vertices. As the grid is the same for all nodes, neighbouring
+ * nodes simplify to matching borders. The levels are generated in
+ * parallel.
+ */
+class LODGenerator : public ISceneNodeVisitor, public IWorkerJob {
+private:
+    struct Item {
+        GeometryNode* node;
+        std::vector<FaceSet*> levels; // coarser levels, 1 and up
+        Vector<3,float> center;
+        float radius;
+    };
+
+    WorkerPool pool;
+    std::vector<Item> items;
+    unsigned int levels;
+    float cellSize;
+
+    // The snapped corners of a face, starting at the smallest so the
+    // same triangle gives the same key whichever corner comes first.
+    struct FaceKey {
+        float v[9];
+        FaceKey(const Face& face) {
+            float corners[3][3];
+            for (unsigned int c = 0; c < 3; c++)
+                for (unsigned int k = 0; k < 3; k++)
+                    corners[c][k] = face.vert[c][k];
+            unsigned int first = 0;
+            for (unsigned int c = 1; c < 3; c++)
+                if (std::lexicographical_compare(corners[c], corners[c] + 3,
+                                                 corners[first], corners[first] + 3))
+                    first = c;
+            for (unsigned int c = 0; c < 3; c++)
+                for (unsigned int k = 0; k < 3; k++)
+                    v[c*3+k] = corners[(first + c) % 3][k];
+        }
+        bool operator<(const FaceKey& other) const {
+            return std::lexicographical_compare(v, v + 9, other.v, other.v + 9);
+        }
+    };
+
+    static float Snap(float x, float size) {
+        return (std::floor(x / size) + 0.5f) * size;
+    }
+
+    // The unnormalized normal of the corners of a face.
+    static Vector<3,float> Normal(const Face& face) {
+        Vector<3,float> a = face.vert[1] - face.vert[0];
+        Vector<3,float> b = face.vert[2] - face.vert[0];
+        return Vector<3,float>(a[1] * b[2] - a[2] * b[1],
+                               a[2] * b[0] - a[0] * b[2],
+                               a[0] * b[1] - a[1] * b[0]);
+    }
+
+public:
+    LODGenerator(unsigned int levels = 3, float cellSize = 2.0f, unsigned int threads = 0)
+        : pool(threads), levels(levels), cellSize(cellSize) {}
+
+    static FaceSet* Simplify(FaceSet& faces, float size) {
+        FaceSet* result = new FaceSet();
+        std::set<FaceKey> kept;
+        for (FaceList::iterator itr = faces.begin(); itr != faces.end(); itr++) {
+            FacePtr face(new Face(**itr));
+            for (unsigned int c = 0; c < 3; c++)
+                for (unsigned int k = 0; k < 3; k++)
+                    face->vert[c][k] = Snap(face->vert[c][k], size);
+            if (face->vert[0] == face->vert[1] ||
+                face->vert[1] == face->vert[2] ||
+                face->vert[2] == face->vert[0])
+                continue;
+
+            // drop faces that collapsed to a line or turned over
+            Vector<3,float> before = Normal(**itr), after = Normal(*face);
+            if (before[0] * after[0] + before[1] * after[1] + before[2] * after[2] <= 0.0f)
+                continue;
+            if (!kept.insert(FaceKey(*face)).second)
+                continue;
+
+            float length = after.GetLength();
+            for (unsigned int c = 0; c < 3; c++)
+                face->norm[c] = after * (1.0f / length);
+            result->Add(face);
+        }
+        return result;
+    }
+
+    void Execute(unsigned int index) {
+        Item& item = items[index];
+        FaceSet* fs = item.node->GetFaceSet();
+
+        Vector<3,float> lo(FLT_MAX, FLT_MAX, FLT_MAX), hi(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+        for (FaceList::iterator itr = fs->begin(); itr != fs->end(); itr++)
+            for (unsigned int c = 0; c < 3; c++)
+                for (unsigned int k = 0; k < 3; k++) {
+                    lo[k] = std::min(lo[k], (*itr)->vert[c][k]);
+                    hi[k] = std::max(hi[k], (*itr)->vert[c][k]);
+                }
+        item.center = (lo + hi) * 0.5f;
+        item.radius = (hi - lo).GetLength() * 0.5f;
+
+        float size = cellSize;
+        for (unsigned int l = 1; l < levels; l++, size *= 4.0f)
+            item.levels.push_back(Simplify(*fs, size));
+    }
+
+    /**
+     * Replace the geometry nodes below root by LODNodes.
+     */
+    void Generate(ISceneNode& root, LODSelector& selector) {
+        items.clear();
+        root.Accept(*this);
+        pool.Run(*this, items.size());
+
+        std::vector<unsigned long> faces(levels, 0);
+        for (unsigned int i = 0; i < items.size(); i++) {
+            Item& item = items[i];
+            ISceneNode* parent = item.node->GetParent();
+            LODNode* lod = new LODNode(selector, item.center, item.radius, levels);
+            parent->RemoveNode(item.node);
+            parent->AddNode(lod);
+
+            LevelNode* full = new LevelNode(*lod, 0);
+            full->AddNode(item.node);
+            lod->AddNode(full);
+            faces[0] += item.node->GetFaceSet()->Size();
+            for (unsigned int l = 0; l < item.levels.size(); l++) {
+                LevelNode* level = new LevelNode(*lod, l + 1);
+                level->AddNode(new GeometryNode(item.levels[l]));
+                lod->AddNode(level);
+                faces[l + 1] += item.levels[l]->Size();
+            }
+        }
+        for (unsigned int l = 0; l < levels; l++)
+            logger.info << "LOD level " << l << ": " << faces[l] << " faces in "
+                        << items.size() << " nodes" << logger.end;
+    }
+
+    void VisitGeometryNode(GeometryNode* node) {
+        if (node->GetParent() != NULL && node->GetFaceSet() != NULL) {
+            Item item;
+            item.node = node;
+            item.radius = 0.0f;
+            items.push_back(item);
+        }
+        node->VisitSubNodes(*this);
+    }
+};
+
+#endif
@@ -0,0 +1,106 @@
+#ifndef _MAPPED_FILE_
+#define _MAPPED_FILE_
+
+#include <istream>
+#include <streambuf>
+#include <string>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/**
+ * A read only memory mapping of a whole file.
+ *
+ * The mapping is shared, so several processes mapping the same file
+ * use the same physical pages.
+ */
+class MappedFile {
+private:
+    const char* data;
+    unsigned long size;
+#if defined(_WIN32)
+    HANDLE file, mapping;
+#else
+    int fd;
+#endif
+
+    MappedFile(const MappedFile&);
+    MappedFile& operator=(const MappedFile&);
+
+public:
+    MappedFile(std::string path)
+        : data(NULL)
+        , size(0)
+    {
+#if defined(_WIN32)
+        mapping = NULL;
+        file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+                           OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (file == INVALID_HANDLE_VALUE) return;
+        size = GetFileSize(file, NULL);
+        if (size == 0) return;
+        mapping = CreateFileMapping(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (mapping == NULL) return;
+        data = (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+#else
+        fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) return;
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size == 0) return;
+        size = st.st_size;
+        void* p = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+        if (p == MAP_FAILED) return;
+        data = (const char*)p;
+#if defined(MADV_SEQUENTIAL)
+        madvise(p, size, MADV_SEQUENTIAL);
+#endif
+#endif
+    }
+
+    ~MappedFile() {
+#if defined(_WIN32)
+        if (data != NULL) UnmapViewOfFile(data);
+        if (mapping != NULL) CloseHandle(mapping);
+        if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+#else
+        if (data != NULL) munmap((void*)data, size);
+        if (fd >= 0) close(fd);
+#endif
+    }
+
+    bool IsOpen() const { return data != NULL; }
+    const char* GetData() const { return data; }
+    unsigned long GetSize() const { return size; }
+};
+
+/**
+ * An input stream reading directly from a block of memory, without
+ * copying it.
+ */
+class MemoryInputStream : public std::istream {
+private:
+    class Buffer : public std::streambuf {
+    public:
+        Buffer(const char* data, unsigned long size) {
+            char* p = const_cast<char*>(data);
+            setg(p, p, p + size);
+        }
+    };
+    Buffer buffer;
+
+public:
+    MemoryInputStream(const char* data, unsigned long size)
+        : std::istream(NULL)
+        , buffer(data, size)
+    {
+        rdbuf(&buffer);
+    }
+};
+
+#endif
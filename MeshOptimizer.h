@@ -0,0 +1,301 @@
+#ifndef _MESH_OPTIMIZER_
+#define _MESH_OPTIMIZER_
+
+#include <Scene/ISceneNode.h>
+#include <Scene/ISceneNodeVisitor.h>
+#include <Scene/GeometryNode.h>
+#include <Geometry/Face.h>
+#include <Geometry/FaceSet.h>
+#include <Logging/Logger.h>
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <vector>
+
+using OpenEngine::Scene::ISceneNode;
+using OpenEngine::Scene::ISceneNodeVisitor;
+using OpenEngine::Scene::GeometryNode;
+using OpenEngine::Geometry::FacePtr;
+using OpenEngine::Geometry::FaceSet;
+using OpenEngine::Geometry::FaceList;
+
+/**
+ * Triangles with welded vertices. A vertex is a position, a normal and
+ * a texture coordinate, stored as eight floats.
+ */
+struct IndexedMesh {
+    static const unsigned int FLOATS = 8;
+    std::vector<float> vertices;
+    std::vector<unsigned int> indices; // three per triangle
+    std::vector<FacePtr> faces;        // the face of each triangle
+
+    unsigned int GetVertexCount() const { return vertices.size() / FLOATS; }
+    unsigned int GetTriangleCount() const { return indices.size() / 3; }
+};
+
+/**
+ * Vertex welding, triangle ordering for the post-transform vertex
+ * cache and cache simulation.
+ */
+class MeshOptimizer : public ISceneNodeVisitor {
+private:
+    struct VertexKey {
+        float v[IndexedMesh::FLOATS];
+        bool operator<(const VertexKey& other) const {
+            for (unsigned int i = 0; i < IndexedMesh::FLOATS; i++) {
+                if (v[i] < other.v[i]) return true;
+                if (other.v[i] < v[i]) return false;
+            }
+            return false;
+        }
+    };
+
+    unsigned int cacheSize;
+    unsigned int triangles;
+    double missesBefore, missesAfter;
+
+    // Vertex score of the linear speed vertex cache optimisation by
+    // Tom Forsyth.
+    static float Score(int cachePosition, unsigned int remaining, unsigned int cacheSize) {
+        if (remaining == 0) return -1.0f;
+        float score = 0.0f;
+        if (cachePosition >= 0) {
+            if (cachePosition < 3)
+                score = 0.75f;
+            else
+                score = std::pow(1.0f - float(cachePosition - 3) / (cacheSize - 3), 1.5f);
+        }
+        return score + 2.0f / std::sqrt(float(remaining));
+    }
+
+public:
+    MeshOptimizer(unsigned int cacheSize = 32)
+        : cacheSize(cacheSize), triangles(0), missesBefore(0), missesAfter(0) {}
+
+    /**
+     * Weld the identical vertices of a face set.
+     */
+    static IndexedMesh Weld(FaceSet& faces) {
+        IndexedMesh mesh;
+        std::map<VertexKey, unsigned int> welded;
+        for (FaceList::iterator itr = faces.begin(); itr != faces.end(); itr++) {
+            FacePtr f = *itr;
+            for (unsigned int c = 0; c < 3; c++) {
+                VertexKey key;
+                for (unsigned int k = 0; k < 3; k++) {
+                    key.v[k] = f->vert[c][k];
+                    key.v[3+k] = f->norm[c][k];
+                }
+                key.v[6] = f->texc[c][0];
+                key.v[7] = f->texc[c][1];
+                std::map<VertexKey, unsigned int>::iterator w = welded.find(key);
+                if (w == welded.end()) {
+                    w = welded.insert(std::make_pair(key, mesh.GetVertexCount())).first;
+                    mesh.vertices.insert(mesh.vertices.end(), key.v, key.v + IndexedMesh::FLOATS);
+                }
+                mesh.indices.push_back(w->second);
+            }
+            mesh.faces.push_back(f);
+        }
+        return mesh;
+    }
+
+    /**
+     * Average cache miss ratio, vertex shader runs per triangle, of
+     * drawing the triangles with a FIFO post-transform cache.
+     */
+    static float ACMR(const std::vector<unsigned int>& indices, unsigned int cacheSize = 16) {
+        if (indices.empty()) return 0.0f;
+        std::vector<int> fifo(cacheSize, -1);
+        unsigned int next = 0, misses = 0;
+        for (unsigned int i = 0; i < indices.size(); i++) {
+            int v = indices[i];
+            bool hit = false;
+            for (unsigned int c = 0; c < cacheSize && !hit; c++)
+                hit = (fifo[c] == v);
+            if (hit) continue;
+            misses++;
+            fifo[next] = v;
+            next = (next + 1) % cacheSize;
+        }
+        return float(misses) / (indices.size() / 3);
+    }
+
+    /**
+     * Reorder the triangles of the mesh for the post-transform vertex
+     * cache, using an LRU cache model of the given size.
+     */
+    static void OrderForCache(IndexedMesh& mesh, unsigned int cacheSize = 32) {
+        const unsigned int nt = mesh.GetTriangleCount();
+        const unsigned int nv = mesh.GetVertexCount();
+        if (nt == 0) return;
+
+        // triangles of each vertex
+        std::vector<unsigned int> offset(nv + 1, 0), remaining(nv, 0);
+        for (unsigned int i = 0; i < mesh.indices.size(); i++)
+            offset[mesh.indices[i] + 1]++;
+        for (unsigned int v = 0; v < nv; v++) {
+            remaining[v] = offset[v + 1];
+            offset[v + 1] += offset[v];
+        }
+        std::vector<unsigned int> adjacent(mesh.indices.size());
+        std::vector<unsigned int> fill(offset.begin(), offset.end() - 1);
+        for (unsigned int t = 0; t < nt; t++)
+            for (unsigned int c = 0; c < 3; c++)
+                adjacent[fill[mesh.indices[3*t+c]]++] = t;
+
+        std::vector<int> position(nv, -1);
+        std::vector<float> vertexScore(nv), triangleScore(nt, 0.0f);
+        for (unsigned int v = 0; v < nv; v++)
+            vertexScore[v] = Score(-1, remaining[v], cacheSize);
+        for (unsigned int t = 0; t < nt; t++)
+            for (unsigned int c = 0; c < 3; c++)
+                triangleScore[t] += vertexScore[mesh.indices[3*t+c]];
+
+        std::vector<char> added(nt, 0);
+        std::vector<unsigned int> order;
+        order.reserve(nt);
+        std::vector<int> cache, newCache;
+        unsigned int scan = 0;
+        int best = -1;
+
+        while (order.size() < nt) {
+            if (best < 0) {
+                // nothing useful in the cache, take the next free triangle
+                while (added[scan]) scan++;
+                best = scan;
+            }
+            added[best] = 1;
+            order.push_back(best);
+
+            // move the triangle's vertices to the front of the cache
+            newCache.clear();
+            for (unsigned int c = 0; c < 3; c++) {
+                unsigned int v = mesh.indices[3*best+c];
+                newCache.push_back(v);
+                // no longer adjacent to the added triangle
+                for (unsigned int a = offset[v]; a < offset[v] + remaining[v]; a++)
+                    if (adjacent[a] == (unsigned int)best) {
+                        adjacent[a] = adjacent[offset[v] + remaining[v] - 1];
+                        remaining[v]--;
+                        break;
+                    }
+            }
+            for (unsigned int i = 0; i < cache.size(); i++)
+                if (std::find(newCache.begin(), newCache.begin() + 3, cache[i]) == newCache.begin() + 3)
+                    newCache.push_back(cache[i]);
+            cache.swap(newCache);
+
+            // rescore the cached vertices and their triangles
+            for (unsigned int i = 0; i < cache.size(); i++) {
+                int v = cache[i];
+                int p = (i < cacheSize) ? (int)i : -1;
+                position[v] = p;
+                float score = Score(p, remaining[v], cacheSize);
+                float delta = score - vertexScore[v];
+                vertexScore[v] = score;
+                for (unsigned int a = offset[v]; a < offset[v] + remaining[v]; a++)
+                    triangleScore[adjacent[a]] += delta;
+            }
+            if (cache.size() > cacheSize) cache.resize(cacheSize);
+
+            // the next triangle is the best one using a cached vertex
+            best = -1;
+            float bestScore = -1.0f;
+            for (unsigned int i = 0; i < cache.size(); i++) {
+                int v = cache[i];
+                for (unsigned int a = offset[v]; a < offset[v] + remaining[v]; a++) {
+                    unsigned int t = adjacent[a];
+                    if (triangleScore[t] > bestScore) {
+                        bestScore = triangleScore[t];
+                        best = t;
+                    }
+                }
+            }
+        }
+
+        std::vector<unsigned int> indices(mesh.indices.size());
+        std::vector<FacePtr> faces(nt);
+        for (unsigned int i = 0; i < nt; i++) {
+            for (unsigned int c = 0; c < 3; c++)
+                indices[3*i+c] = mesh.indices[3*order[i]+c];
+            faces[i] = mesh.faces[order[i]];
+        }
+        mesh.indices.swap(indices);
+        mesh.faces.swap(faces);
+    }
+
+    /**
+     * Reorder the faces of every geometry node below node for the
+     * vertex cache. The vertex arrays made from the faces keep their
+     * order.
+     *
+     * The vertex array transformer does not index its arrays, so the
+     * logged ACMR is an estimate for the welded, indexed meshes, not
+     * what is drawn.
+     */
+    void Optimize(ISceneNode& node) {
+        triangles = 0;
+        missesBefore = missesAfter = 0;
+        node.Accept(*this);
+        if (triangles == 0) return;
+        logger.info << "Mesh optimization: " << triangles
+                    << " triangles, estimated ACMR if indexed "
+                    << missesBefore / triangles << " -> "
+                    << missesAfter / triangles << logger.end;
+    }
+
+    void VisitGeometryNode(GeometryNode* node) {
+        FaceSet* fs = node->GetFaceSet();
+        if (fs != NULL) {
+            // reorder every run of one material on its own, so the
+            // material groups of the static batcher stay together
+            FaceList::iterator run = fs->begin();
+            while (run != fs->end()) {
+                FaceSet faces;
+                FaceList::iterator end = run;
+                for (; end != fs->end() && (*end)->mat == (*run)->mat; end++)
+                    faces.Add(*end);
+                IndexedMesh mesh = Weld(faces);
+                unsigned int n = mesh.GetTriangleCount();
+                missesBefore += ACMR(mesh.indices) * n;
+                OrderForCache(mesh, cacheSize);
+                missesAfter += ACMR(mesh.indices) * n;
+                triangles += n;
+                unsigned int i = 0;
+                for (FaceList::iterator itr = run; itr != end; itr++)
+                    *itr = mesh.faces[i++];
+                run = end;
+            }
+        }
+        node->VisitSubNodes(*this);
+    }
+};
+
+/**
+ * Memory and cache efficiency of a mesh before and after optimization.
+ * The ACMR values are estimates for the welded, indexed mesh.
+ */
+struct MeshStats {
+    unsigned int triangles, vertices, weldedVertices;
+    unsigned long unindexedBytes; // float attributes, three vertices per triangle
+    unsigned long indexedBytes;   // welded float attributes and 32 bit indices
+    unsigned long quantizedBytes; // welded, 10:10:10 normals, 16 bit texture coordinates
+    float acmrBefore, acmrAfter;
+
+    MeshStats(FaceSet& faces, unsigned int cacheSize = 16) {
+        IndexedMesh mesh = MeshOptimizer::Weld(faces);
+        triangles = mesh.GetTriangleCount();
+        vertices = triangles * 3;
+        weldedVertices = mesh.GetVertexCount();
+        unindexedBytes = (unsigned long)vertices * 32;
+        indexedBytes = (unsigned long)weldedVertices * 32 + mesh.indices.size() * 4;
+        quantizedBytes = (unsigned long)weldedVertices * (12 + 4 + 4) + mesh.indices.size() * 4;
+        acmrBefore = MeshOptimizer::ACMR(mesh.indices, cacheSize);
+        MeshOptimizer::OrderForCache(mesh);
+        acmrAfter = MeshOptimizer::ACMR(mesh.indices, cacheSize);
+    }
+};
+
+#endif
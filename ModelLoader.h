@@ -0,0 +1,252 @@
+#ifndef _MODEL_LOADER_
+#define _MODEL_LOADER_
+
+#include <Core/Exceptions.h>
+#include <Resources/IModelResource.h>
+#include <Resources/ITextureResource.h>
+#include <Resources/ResourceManager.h>
+#include <Resources/DirectoryManager.h>
+#include <Resources/File.h>
+#include <Scene/ISceneNode.h>
+#include <Scene/ISceneNodeVisitor.h>
+#include <Scene/GeometryNode.h>
+#include <Geometry/FaceSet.h>
+#include <Geometry/Material.h>
+#include <Utils/Timer.h>
+#include <Logging/Logger.h>
+
+#include "WorkerPool.h"
+#include "AllocationCounter.h"
+
+#include <fstream>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using OpenEngine::Core::Exception;
+using OpenEngine::Resources::IModelResource;
+using OpenEngine::Resources::IModelResourcePtr;
+using OpenEngine::Resources::ITextureResource;
+using OpenEngine::Resources::ITextureResourcePtr;
+using OpenEngine::Resources::ResourceManager;
+using OpenEngine::Resources::DirectoryManager;
+using OpenEngine::Resources::File;
+using OpenEngine::Scene::ISceneNode;
+using OpenEngine::Scene::ISceneNodeVisitor;
+using OpenEngine::Scene::GeometryNode;
+using OpenEngine::Geometry::FaceSet;
+using OpenEngine::Geometry::FaceList;
+using OpenEngine::Utils::Timer;
+
+/**
+ * The sections of models.txt. Models listed before the first section
+ * keyword are added to the dynamic scene without a rigid box. Models
+ * in the shared section are loaded once and feed both the static and
+ * the physics scene.
+ */
+enum ModelSection {
+    SECTION_NONE,
+    SECTION_DYNAMIC,
+    SECTION_STATIC,
+    SECTION_PHYSIC,
+    SECTION_SHARED
+};
+
+struct ModelEntry {
+    std::string  file;
+    ModelSection section;
+    ISceneNode*  node;
+    unsigned int  loadTime;    // microseconds
+    unsigned long allocations; // made while loading
+    bool          skip;        // not loaded, e.g. when found in a cache
+    ModelEntry(std::string file, ModelSection section)
+        : file(file), section(section), node(NULL)
+        , loadTime(0), allocations(0), skip(false) {}
+};
+
+/**
+ * Read a model list. Empty lines and lines starting with '#' are
+ * ignored, the keywords dynamic, static, physic and shared switch
+ * section.
+ */
+inline std::vector<ModelEntry> ReadModelList(std::string path) {
+    std::vector<ModelEntry> models;
+    std::ifstream* mfile = File::Open(DirectoryManager::FindFileInPath(path));
+    ModelSection section = SECTION_NONE;
+    while (!mfile->eof()) {
+        std::string mod_str;
+        getline(*mfile, mod_str);
+
+        if (mod_str[0] == '#' || mod_str == "") continue;
+
+        if      (mod_str == "dynamic") section = SECTION_DYNAMIC;
+        else if (mod_str == "static")  section = SECTION_STATIC;
+        else if (mod_str == "physic")  section = SECTION_PHYSIC;
+        else if (mod_str == "shared")  section = SECTION_SHARED;
+        else models.push_back(ModelEntry(mod_str, section));
+    }
+    mfile->close();
+    delete mfile;
+    return models;
+}
+
+/**
+ * Loads the models of a model list on a worker pool.
+ *
+ * The resource manager is not thread safe, so all model resources and
+ * the textures referenced from their material libraries are created
+ * on the calling thread before any worker starts. The workers only
+ * parse files and build the scene nodes. Results are stored per entry,
+ * so attaching them afterwards happens in list order.
+ *
+ * The texture names are read from the material libraries the way the
+ * OBJ loader is expected to name them. As a name read differently
+ * would have been created by a worker, the loaded scenes are checked
+ * to only use the textures created up front, and Load throws if one
+ * does not.
+ */
+class ModelLoader : public IWorkerJob {
+private:
+    WorkerPool pool;
+    std::vector<ModelEntry>* models;
+    std::vector<IModelResourcePtr> resources;
+    std::vector<ITextureResourcePtr> textures;
+
+    // Finds a texture of a loaded scene that is not in a set.
+    class TextureCheck : public ISceneNodeVisitor {
+    public:
+        const std::set<ITextureResource*>& known;
+        ITextureResource* unknown;
+        TextureCheck(const std::set<ITextureResource*>& known)
+            : known(known), unknown(NULL) {}
+        void VisitGeometryNode(GeometryNode* node) {
+            FaceSet* fs = node->GetFaceSet();
+            if (fs == NULL || unknown != NULL) return;
+            for (FaceList::iterator itr = fs->begin(); itr != fs->end(); itr++) {
+                ITextureResource* tex = (*itr)->mat ? (*itr)->mat->texr.get() : NULL;
+                if (tex != NULL && known.find(tex) == known.end()) {
+                    unknown = tex;
+                    return;
+                }
+            }
+        }
+    };
+
+    static std::string Directory(std::string file) {
+        std::string::size_type pos = file.find_last_of("/\\");
+        return (pos == std::string::npos) ? "" : file.substr(0, pos+1);
+    }
+
+    // Create the textures of an OBJ file.
+    void CreateTextures(std::string file) {
+        std::vector<std::string> names = TextureNames(file);
+        for (unsigned int i = 0; i < names.size(); i++)
+            textures.push_back(ResourceManager<ITextureResource>::Create(names[i]));
+    }
+
+    // Throw if a loaded model uses a texture that a worker created.
+    void CheckTextures() {
+        std::set<ITextureResource*> known;
+        for (unsigned int i = 0; i < textures.size(); i++)
+            known.insert(textures[i].get());
+        for (unsigned int i = 0; i < models->size(); i++) {
+            ModelEntry& entry = (*models)[i];
+            if (entry.node == NULL) continue;
+            TextureCheck check(known);
+            entry.node->Accept(check);
+            if (check.unknown != NULL)
+                throw Exception("Model " + entry.file + " loaded a texture that "
+                                "was not created before the workers started; "
+                                "load it with --load-threads 1");
+        }
+    }
+
+public:
+    /**
+     * The material libraries named by mtllib statements of an OBJ
+     * file, relative to the data path.
+     */
+    static std::vector<std::string> MaterialLibraries(std::string file) {
+        std::vector<std::string> libs;
+        std::string dir = Directory(file);
+        std::ifstream obj(DirectoryManager::FindFileInPath(file).c_str());
+        std::string line;
+        while (getline(obj, line))
+            if (line.compare(0, 7, "mtllib ") == 0)
+                libs.push_back(dir + line.substr(7));
+        return libs;
+    }
+
+    /**
+     * The textures named by map_* statements in the material libraries
+     * of an OBJ file, relative to the data path.
+     */
+    static std::vector<std::string> TextureNames(std::string file) {
+        std::vector<std::string> textures;
+        std::string dir = Directory(file);
+        std::vector<std::string> libs = MaterialLibraries(file);
+        for (unsigned int i = 0; i < libs.size(); i++) {
+            std::ifstream mtl(DirectoryManager::FindFileInPath(libs[i]).c_str());
+            std::string mline;
+            while (getline(mtl, mline)) {
+                std::istringstream words(mline);
+                std::string key, tex;
+                words >> key >> tex;
+                if (key.compare(0, 4, "map_") == 0 && !tex.empty())
+                    textures.push_back(dir + tex);
+            }
+        }
+        return textures;
+    }
+
+    ModelLoader(unsigned int threads = 0)
+        : pool(threads)
+        , models(NULL)
+    {}
+
+    void Load(std::vector<ModelEntry>& models) {
+        this->models = &models;
+        resources.clear();
+        textures.clear();
+        for (unsigned int i = 0; i < models.size(); i++) {
+            if (models[i].skip) {
+                resources.push_back(IModelResourcePtr());
+                continue;
+            }
+            if (pool.GetThreadCount() > 1)
+                CreateTextures(models[i].file);
+            resources.push_back(ResourceManager<IModelResource>::Create(models[i].file));
+        }
+
+        Timer timer;
+        timer.Start();
+        pool.Run(*this, models.size());
+        logger.info << "Loaded " << models.size() << " models on "
+                    << pool.GetThreadCount() << " threads in "
+                    << timer.GetElapsedTime().AsInt() / 1000 << " ms"
+                    << logger.end;
+
+        if (pool.GetThreadCount() > 1)
+            CheckTextures();
+        resources.clear();
+        textures.clear();
+        this->models = NULL;
+    }
+
+    void Execute(unsigned int index) {
+        ModelEntry& entry = (*models)[index];
+        if (entry.skip) return;
+        unsigned long allocations = GetThreadAllocationCount();
+        Timer timer;
+        timer.Start();
+        IModelResourcePtr mod_res = resources[index];
+        mod_res->Load();
+        entry.node = mod_res->GetSceneNode();
+        mod_res->Unload();
+        entry.loadTime = timer.GetElapsedTime().AsInt();
+        entry.allocations = GetThreadAllocationCount() - allocations;
+    }
+};
+
+#endif
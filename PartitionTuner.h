@@ -0,0 +1,156 @@
+#ifndef _PARTITION_TUNER_
+#define _PARTITION_TUNER_
+
+#include <Display/IViewingVolume.h>
+#include <Scene/ISceneNode.h>
+#include <Scene/ISceneNodeVisitor.h>
+#include <Scene/GeometryNode.h>
+#include <Scene/TransformationNode.h>
+#include <Geometry/FaceSet.h>
+#include <Math/Quaternion.h>
+#include <Math/Vector.h>
+
+#include "Views.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <string>
+#include <vector>
+
+using OpenEngine::Display::IViewingVolume;
+using OpenEngine::Scene::ISceneNode;
+using OpenEngine::Scene::ISceneNodeVisitor;
+using OpenEngine::Scene::GeometryNode;
+using OpenEngine::Scene::TransformationNode;
+using OpenEngine::Geometry::FaceSet;
+using OpenEngine::Geometry::FaceList;
+using OpenEngine::Math::Quaternion;
+using OpenEngine::Math::Vector;
+
+/**
+ * The geometry nodes of a partitioned scene with their world space
+ * bounding boxes, for counting what frustum culling would draw from a
+ * view.
+ */
+class VisibleGeometry : public ISceneNodeVisitor {
+private:
+    std::vector<float> boxes; // low and high corner of each node
+    std::vector<unsigned int> faces;
+
+    // world transformations of the transformation nodes being visited,
+    // composed as the render list does
+    struct Transform {
+        Vector<3,float> position, scale;
+        Quaternion<float> rotation;
+    };
+    std::vector<Transform> transforms;
+
+    Vector<3,float> ToWorld(Vector<3,float> v) {
+        if (transforms.empty()) return v;
+        Transform& t = transforms.back();
+        return t.position + t.rotation.RotateVector(
+            Vector<3,float>(v[0]*t.scale[0], v[1]*t.scale[1], v[2]*t.scale[2]));
+    }
+
+public:
+    VisibleGeometry(ISceneNode& root) {
+        root.Accept(*this);
+    }
+
+    /**
+     * Add the faces and nodes inside the frustum of the view.
+     */
+    void Count(IViewingVolume& view, unsigned long& drawnFaces,
+               unsigned long& drawnNodes) {
+        float planes[6][4];
+        GetFrustumPlanes(view, planes);
+        for (unsigned int i = 0; i < faces.size(); i++) {
+            const float* lo = &boxes[6*i];
+            const float* hi = &boxes[6*i+3];
+            bool inside = true;
+            for (unsigned int p = 0; p < 6 && inside; p++) {
+                const float* pl = planes[p];
+                float d = pl[3];
+                for (unsigned int k = 0; k < 3; k++)
+                    d += std::max(pl[k] * lo[k], pl[k] * hi[k]);
+                inside = (d >= 0.0f);
+            }
+            if (!inside) continue;
+            drawnFaces += faces[i];
+            drawnNodes++;
+        }
+    }
+
+    void VisitTransformationNode(TransformationNode* node) {
+        Transform t;
+        Vector<3,float> p = node->GetPosition();
+        Vector<3,float> s = node->GetScale();
+        if (transforms.empty()) {
+            t.position = p;
+            t.scale = s;
+            t.rotation = node->GetRotation();
+        } else {
+            Transform parent = transforms.back();
+            Vector<3,float> ps = parent.scale;
+            t.position = parent.position + parent.rotation.RotateVector(
+                Vector<3,float>(p[0]*ps[0], p[1]*ps[1], p[2]*ps[2]));
+            t.scale = Vector<3,float>(s[0]*ps[0], s[1]*ps[1], s[2]*ps[2]);
+            t.rotation = parent.rotation * node->GetRotation();
+        }
+        transforms.push_back(t);
+        node->VisitSubNodes(*this);
+        transforms.pop_back();
+    }
+
+    void VisitGeometryNode(GeometryNode* node) {
+        FaceSet* fs = node->GetFaceSet();
+        if (fs != NULL && fs->Size() > 0) {
+            float lo[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+            float hi[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+            for (FaceList::iterator itr = fs->begin(); itr != fs->end(); itr++)
+                for (unsigned int c = 0; c < 3; c++) {
+                    Vector<3,float> v = ToWorld((*itr)->vert[c]);
+                    for (unsigned int k = 0; k < 3; k++) {
+                        lo[k] = std::min(lo[k], v[k]);
+                        hi[k] = std::max(hi[k], v[k]);
+                    }
+                }
+            boxes.insert(boxes.end(), lo, lo + 3);
+            boxes.insert(boxes.end(), hi, hi + 3);
+            faces.push_back(fs->Size());
+        }
+        node->VisitSubNodes(*this);
+    }
+};
+
+/**
+ * One measured setting of the partition parameters. The cost is what
+ * the setting is ranked by, lower is better.
+ */
+struct PartitionSetting {
+    std::string scene;
+    unsigned int maxFaceCount, maxQuadSize;
+    double buildTime; // ms
+    unsigned int nodes, depth;
+    unsigned long faces; // face references in the tree
+    unsigned long bytes;
+    double cost;
+
+    /**
+     * The index of the cheapest setting of a scene, the smaller tree
+     * of equally cheap ones, or -1 if there is none.
+     */
+    static int Best(const std::vector<PartitionSetting>& settings, std::string scene) {
+        int best = -1;
+        for (unsigned int i = 0; i < settings.size(); i++) {
+            const PartitionSetting& s = settings[i];
+            if (s.scene != scene) continue;
+            if (best < 0 || s.cost < settings[best].cost ||
+                (s.cost == settings[best].cost && s.bytes < settings[best].bytes))
+                best = i;
+        }
+        return best;
+    }
+};
+
+#endif
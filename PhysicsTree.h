@@ -0,0 +1,96 @@
+#ifndef _PHYSICS_TREE_
+#define _PHYSICS_TREE_
+
+#include <Scene/ISceneNode.h>
+#include <Scene/ISceneNodeVisitor.h>
+#include <Scene/SceneNode.h>
+#include <Scene/GeometryNode.h>
+#include <Scene/BSPTransformer.h>
+#include <Geometry/FaceSet.h>
+
+#include "WorkerPool.h"
+
+#include <algorithm>
+#include <vector>
+
+using OpenEngine::Scene::ISceneNode;
+using OpenEngine::Scene::ISceneNodeVisitor;
+using OpenEngine::Scene::SceneNode;
+using OpenEngine::Scene::GeometryNode;
+using OpenEngine::Scene::BSPTransformer;
+using OpenEngine::Geometry::FaceSet;
+
+/**
+ * Builds the BSP trees of the cells of a quad tree in parallel.
+ *
+ * Every geometry node left by the QuadTransformer is swapped for a
+ * placeholder and moved below a private root, where a BSPTransformer
+ * of its own turns it into a BSP tree on the worker pool. The trees
+ * then replace the placeholders in place, so the result, and its
+ * serialization, is the same as running one BSPTransformer over the
+ * whole scene. The cells are sorted largest first, and the pool hands
+ * them out in that order, so the largest cells are started first and
+ * the small ones fill in at the end.
+ */
+class ParallelBSPBuilder : public ISceneNodeVisitor, public IWorkerJob {
+private:
+    struct Cell {
+        ISceneNode* parent;
+        ISceneNode* placeholder;
+        SceneNode* root;
+        unsigned int faces;
+        bool operator<(const Cell& other) const { return faces > other.faces; }
+    };
+
+    WorkerPool pool;
+    std::vector<GeometryNode*> leaves;
+    std::vector<Cell> cells;
+
+public:
+    ParallelBSPBuilder(unsigned int threads = 0) : pool(threads) {}
+
+    unsigned int GetThreadCount() const { return pool.GetThreadCount(); }
+    unsigned int GetCellCount() const { return cells.size(); }
+
+    void Transform(ISceneNode& node) {
+        leaves.clear();
+        cells.clear();
+        node.Accept(*this);
+
+        for (unsigned int i = 0; i < leaves.size(); i++) {
+            GeometryNode* leaf = leaves[i];
+            Cell c;
+            c.parent = leaf->GetParent();
+            if (c.parent == NULL) continue;
+            c.placeholder = new SceneNode();
+            c.root = new SceneNode();
+            c.faces = leaf->GetFaceSet() ? leaf->GetFaceSet()->Size() : 0;
+            c.parent->ReplaceNode(leaf, c.placeholder);
+            c.root->AddNode(leaf);
+            cells.push_back(c);
+        }
+        std::stable_sort(cells.begin(), cells.end());
+
+        pool.Run(*this, cells.size());
+
+        for (unsigned int i = 0; i < cells.size(); i++) {
+            Cell& c = cells[i];
+            ISceneNode* tree = c.root->GetNode(0);
+            c.root->RemoveNode(tree);
+            c.parent->ReplaceNode(c.placeholder, tree);
+            delete c.root;
+            delete c.placeholder;
+        }
+    }
+
+    void Execute(unsigned int index) {
+        BSPTransformer bspT;
+        bspT.Transform(*cells[index].root);
+    }
+
+    void VisitGeometryNode(GeometryNode* node) {
+        leaves.push_back(node);
+    }
+};
+
+#endif
@@ -0,0 +1,234 @@
+#ifndef _PROFILER_
+#define _PROFILER_
+
+#include <Core/IListener.h>
+#include <Core/IModule.h>
+#include <Display/ICanvasBackend.h>
+#include <Resources/ITexture2D.h>
+#include <Utils/Timer.h>
+#include <Logging/Logger.h>
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+using OpenEngine::Core::IListener;
+using OpenEngine::Core::DeinitializeEventArg;
+using OpenEngine::Display::ICanvasBackend;
+using OpenEngine::Resources::ITexture2DPtr;
+using OpenEngine::Utils::Timer;
+
+/**
+ * Records timed stages into a fixed size ring buffer.
+ *
+ * Stage names are registered once and events only store the name
+ * index, so recording does not allocate. When the buffer is full the
+ * oldest events are overwritten. Times are microseconds since the
+ * profiler was created.
+ */
+class Profiler {
+public:
+    struct Event {
+        unsigned int name;
+        unsigned int thread;
+        unsigned int start;
+        unsigned int duration;
+    };
+
+private:
+    std::vector<std::string> names;
+    std::vector<Event> events;
+    unsigned int next;
+    bool wrapped;
+    Timer timer;
+
+public:
+    Profiler(unsigned int capacity = 1 << 16)
+        : events(capacity)
+        , next(0)
+        , wrapped(false)
+    {
+        timer.Start();
+    }
+
+    unsigned int Register(std::string name) {
+        for (unsigned int i = 0; i < names.size(); i++)
+            if (names[i] == name) return i;
+        names.push_back(name);
+        return names.size() - 1;
+    }
+
+    unsigned int Now() {
+        return timer.GetElapsedTime().AsInt();
+    }
+
+    void Record(unsigned int name, unsigned int start, unsigned int end,
+                unsigned int thread = 0) {
+        Event& e = events[next];
+        e.name = name;
+        e.thread = thread;
+        e.start = start;
+        e.duration = end - start;
+        if (++next == events.size()) {
+            next = 0;
+            wrapped = true;
+        }
+    }
+
+    unsigned int GetEventCount() const {
+        return wrapped ? events.size() : next;
+    }
+
+    // Events in recording order, oldest first.
+    const Event& GetEvent(unsigned int i) const {
+        return events[wrapped ? (next + i) % events.size() : i];
+    }
+
+    std::string GetName(unsigned int name) const { return names[name]; }
+
+    /**
+     * Write the events in the Chrome trace event format, viewable in
+     * chrome://tracing.
+     */
+    void WriteChromeTrace(std::ostream& out) const {
+        out << "{\"traceEvents\":[\n";
+        for (unsigned int i = 0; i < GetEventCount(); i++) {
+            const Event& e = GetEvent(i);
+            out << (i ? ",\n" : "")
+                << "{\"name\":\"" << names[e.name] << "\",\"ph\":\"X\""
+                << ",\"pid\":1,\"tid\":" << e.thread
+                << ",\"ts\":" << e.start << ",\"dur\":" << e.duration << "}";
+        }
+        out << "\n]}\n";
+    }
+
+    void WriteCSV(std::ostream& out) const {
+        out << "stage,thread,start_us,duration_us\n";
+        for (unsigned int i = 0; i < GetEventCount(); i++) {
+            const Event& e = GetEvent(i);
+            out << names[e.name] << "," << e.thread << ","
+                << e.start << "," << e.duration << "\n";
+        }
+    }
+
+    /**
+     * Write to a file, as CSV if the name ends in .csv and as a
+     * Chrome trace otherwise.
+     */
+    void Write(std::string file) const {
+        std::ofstream out(file.c_str());
+        if (!out.good()) {
+            logger.error << "Can not open '" << file << "' for output"
+                         << logger.end;
+            return;
+        }
+        if (file.size() >= 4 && file.substr(file.size() - 4) == ".csv")
+            WriteCSV(out);
+        else
+            WriteChromeTrace(out);
+        logger.info << "Saved " << GetEventCount() << " profile events to '"
+                    << file << "'" << logger.end;
+    }
+};
+
+/**
+ * Records the lifetime of the object as one event.
+ */
+class ScopedTimer {
+private:
+    Profiler& profiler;
+    unsigned int name, start, thread;
+
+public:
+    ScopedTimer(Profiler& profiler, unsigned int name, unsigned int thread = 0)
+        : profiler(profiler), name(name), start(profiler.Now()), thread(thread) {}
+    ~ScopedTimer() {
+        profiler.Record(name, start, profiler.Now(), thread);
+    }
+};
+
+/**
+ * Forwards events to another listener and times each call.
+ */
+template <class EventArg>
+class ProfiledListener : public IListener<EventArg> {
+private:
+    IListener<EventArg>& listener;
+    Profiler& profiler;
+    unsigned int name;
+
+public:
+    ProfiledListener(IListener<EventArg>& listener, Profiler& profiler, std::string name)
+        : listener(listener), profiler(profiler), name(profiler.Register(name)) {}
+
+    void Handle(EventArg arg) {
+        ScopedTimer t(profiler, name);
+        listener.Handle(arg);
+    }
+};
+
+/**
+ * Wraps the backend of a canvas. Everything between Pre and Post is
+ * recorded as the canvas render and the Post of the wrapped backend,
+ * which copies the frame buffer into the canvas texture, as its copy.
+ */
+class ProfiledCanvasBackend : public ICanvasBackend {
+private:
+    ICanvasBackend* backend;
+    Profiler& profiler;
+    std::string label;
+    unsigned int render, copy, start;
+
+public:
+    ProfiledCanvasBackend(ICanvasBackend* backend, Profiler& profiler, std::string name)
+        : backend(backend)
+        , profiler(profiler)
+        , label(name)
+        , render(profiler.Register("render " + name))
+        , copy(profiler.Register("copy " + name))
+        , start(0)
+    {}
+
+    virtual ~ProfiledCanvasBackend() { delete backend; }
+
+    void Create(unsigned int width, unsigned int height) { backend->Create(width, height); }
+    void Init(unsigned int width, unsigned int height) { backend->Init(width, height); }
+    void Deinit() { backend->Deinit(); }
+    void Resize(unsigned int width, unsigned int height) { backend->Resize(width, height); }
+    ITexture2DPtr GetTexture() { return backend->GetTexture(); }
+
+    ICanvasBackend* Clone() {
+        return new ProfiledCanvasBackend(backend->Clone(), profiler, label);
+    }
+
+    void Pre() {
+        start = profiler.Now();
+        backend->Pre();
+    }
+
+    void Post() {
+        unsigned int end = profiler.Now();
+        profiler.Record(render, start, end);
+        backend->Post();
+        profiler.Record(copy, end, profiler.Now());
+    }
+};
+
+/**
+ * Writes the profile when the engine shuts down.
+ */
+class ProfileWriter : public IListener<DeinitializeEventArg> {
+private:
+    Profiler& profiler;
+    std::string file;
+
+public:
+    ProfileWriter(Profiler& profiler, std::string file)
+        : profiler(profiler), file(file) {}
+
+    void Handle(DeinitializeEventArg arg) {
+        profiler.Write(file);
+    }
+};
+
+#endif
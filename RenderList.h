@@ -0,0 +1,257 @@
+#ifndef _RENDER_LIST_
+#define _RENDER_LIST_
+
+#include <Core/IListener.h>
+#include <Core/IModule.h>
+#include <Scene/ISceneNode.h>
+#include <Scene/ISceneNodeVisitor.h>
+#include <Scene/SceneNode.h>
+#include <Scene/TransformationNode.h>
+#include <Scene/GeometryNode.h>
+#include <Scene/VertexArrayNode.h>
+#include <Scene/RenderStateNode.h>
+#include <Scene/PointLightNode.h>
+#include <Scene/DirectionalLightNode.h>
+#include <Scene/SpotLightNode.h>
+#include <Math/Quaternion.h>
+#include <Math/Vector.h>
+#include <Logging/Logger.h>
+
+#include <typeinfo>
+#include <vector>
+
+using OpenEngine::Core::IListener;
+using OpenEngine::Core::ProcessEventArg;
+using OpenEngine::Scene::ISceneNode;
+using OpenEngine::Scene::ISceneNodeVisitor;
+using OpenEngine::Scene::SceneNode;
+using OpenEngine::Scene::TransformationNode;
+using OpenEngine::Scene::GeometryNode;
+using OpenEngine::Scene::VertexArrayNode;
+using OpenEngine::Scene::RenderStateNode;
+using OpenEngine::Scene::PointLightNode;
+using OpenEngine::Scene::DirectionalLightNode;
+using OpenEngine::Scene::SpotLightNode;
+using OpenEngine::Math::Quaternion;
+using OpenEngine::Math::Vector;
+
+/**
+ * A compiled, flat version of a scene for rendering.
+ *
+ * The source scene is walked once. Plain scene nodes disappear and the
+ * transformation nodes are replaced by a flat array of world
+ * transformations, each referring to its parent by index. Every other
+ * node (geometry, vertex arrays, lights, render states, cull nodes) is
+ * a draw item and is drawn as a whole. Draw items that share a world
+ * transformation form a run, which is drawn below one transformation
+ * node. Rendering the list walks the runs and items linearly instead of
+ * chasing the pointers of the source tree.
+ *
+ * Once per frame the local transformations of the source are compared
+ * with the ones the world transformations were computed from, and only
+ * changed transformations and their descendants are recomputed. When
+ * nodes are added to or removed from the source, call Invalidate to
+ * compile the list again.
+ *
+ * The world transformations are composed from position, rotation and
+ * scale, so non uniform scales below rotations are not supported.
+ */
+class RenderListNode : public SceneNode, public IListener<ProcessEventArg> {
+private:
+    struct Run {
+        int transform; // -1: untransformed
+        unsigned int begin, end;
+    };
+
+    // Draws the items of one run below the run's world transformation.
+    class RunNode : public TransformationNode {
+    private:
+        RenderListNode* list;
+        unsigned int begin, end;
+    public:
+        RunNode() : list(NULL), begin(0), end(0) {}
+        void Set(RenderListNode* list, unsigned int begin, unsigned int end) {
+            this->list = list;
+            this->begin = begin;
+            this->end = end;
+        }
+        void VisitSubNodes(ISceneNodeVisitor& visitor) {
+            list->VisitItems(begin, end, visitor);
+        }
+    };
+
+    class Compiler : public ISceneNodeVisitor {
+    private:
+        RenderListNode& list;
+        int parent;
+    public:
+        Compiler(RenderListNode& list) : list(list), parent(-1) {}
+        void VisitSceneNode(SceneNode* node) {
+            if (typeid(*node) == typeid(SceneNode))
+                node->VisitSubNodes(*this);
+            else
+                list.AddItem(node, parent);
+        }
+        void VisitTransformationNode(TransformationNode* node) {
+            int p = parent;
+            parent = list.AddTransform(node, p);
+            node->VisitSubNodes(*this);
+            parent = p;
+        }
+        void VisitGeometryNode(GeometryNode* node)       { list.AddItem(node, parent); }
+        void VisitVertexArrayNode(VertexArrayNode* node) { list.AddItem(node, parent); }
+        void VisitRenderStateNode(RenderStateNode* node) { list.AddItem(node, parent); }
+        void VisitPointLightNode(PointLightNode* node)   { list.AddItem(node, parent); }
+        void VisitDirectionalLightNode(DirectionalLightNode* node) { list.AddItem(node, parent); }
+        void VisitSpotLightNode(SpotLightNode* node)     { list.AddItem(node, parent); }
+    };
+
+    ISceneNode& source;
+
+    // draw items and runs, in drawing order
+    std::vector<ISceneNode*> items;
+    std::vector<Run> runs;
+    RunNode* runNodes;
+
+    // transformations, parents before children
+    std::vector<TransformationNode*> transforms;
+    std::vector<int> parents;
+    std::vector< Vector<3,float> > localPosition, localScale, worldPosition, worldScale;
+    std::vector< Quaternion<float> > localRotation, worldRotation;
+    std::vector<char> changed;
+
+    bool compiled, dirty, first;
+
+    int AddTransform(TransformationNode* node, int parent) {
+        transforms.push_back(node);
+        parents.push_back(parent);
+        return transforms.size() - 1;
+    }
+
+    void AddItem(ISceneNode* node, int transform) {
+        if (runs.empty() || runs.back().transform != transform) {
+            Run r;
+            r.transform = transform;
+            r.begin = r.end = items.size();
+            runs.push_back(r);
+        }
+        items.push_back(node);
+        runs.back().end = items.size();
+    }
+
+    void Compile() {
+        delete[] runNodes;
+        items.clear();
+        runs.clear();
+        transforms.clear();
+        parents.clear();
+
+        Compiler c(*this);
+        source.VisitSubNodes(c);
+
+        unsigned int n = transforms.size();
+        localPosition.resize(n);
+        localScale.resize(n);
+        localRotation.resize(n);
+        worldPosition.resize(n);
+        worldScale.resize(n);
+        worldRotation.resize(n);
+        changed.resize(n);
+
+        runNodes = new RunNode[runs.size()];
+        for (unsigned int i = 0; i < runs.size(); i++)
+            runNodes[i].Set(this, runs[i].begin, runs[i].end);
+
+        compiled = true;
+        first = true;
+        logger.info << "Compiled the render list: " << items.size()
+                    << " items in " << runs.size() << " runs, "
+                    << n << " transformations" << logger.end;
+    }
+
+    static bool Equal(Quaternion<float> a, Quaternion<float> b) {
+        return a.GetReal() == b.GetReal() && a.GetImaginary() == b.GetImaginary();
+    }
+
+    // Recompute the world transformations that changed since the last frame.
+    void Update() {
+        for (unsigned int i = 0; i < transforms.size(); i++) {
+            TransformationNode* t = transforms[i];
+            Vector<3,float> p = t->GetPosition();
+            Vector<3,float> s = t->GetScale();
+            Quaternion<float> q = t->GetRotation();
+            int parent = parents[i];
+            changed[i] = first
+                || (parent >= 0 && changed[parent])
+                || !(p == localPosition[i])
+                || !(s == localScale[i])
+                || !Equal(q, localRotation[i]);
+            if (!changed[i]) continue;
+
+            localPosition[i] = p;
+            localScale[i] = s;
+            localRotation[i] = q;
+            if (parent < 0) {
+                worldPosition[i] = p;
+                worldScale[i] = s;
+                worldRotation[i] = q;
+                continue;
+            }
+            Vector<3,float> ps = worldScale[parent];
+            Quaternion<float> pr = worldRotation[parent];
+            worldPosition[i] = worldPosition[parent]
+                + pr.RotateVector(Vector<3,float>(p[0]*ps[0], p[1]*ps[1], p[2]*ps[2]));
+            worldScale[i] = Vector<3,float>(s[0]*ps[0], s[1]*ps[1], s[2]*ps[2]);
+            worldRotation[i] = pr * q;
+        }
+
+        for (unsigned int i = 0; i < runs.size(); i++) {
+            int t = runs[i].transform;
+            if (t < 0 || !changed[t]) continue;
+            runNodes[i].SetPosition(worldPosition[t]);
+            runNodes[i].SetScale(worldScale[t]);
+            runNodes[i].SetRotation(worldRotation[t]);
+        }
+        first = false;
+        dirty = false;
+    }
+
+    void VisitItems(unsigned int begin, unsigned int end, ISceneNodeVisitor& visitor) {
+        for (unsigned int i = begin; i < end; i++)
+            items[i]->Accept(visitor);
+    }
+
+public:
+    /**
+     * Compile the sub nodes of source. The source itself is not drawn,
+     * so it must not be a transformation or render state.
+     */
+    RenderListNode(ISceneNode& source)
+        : source(source)
+        , runNodes(NULL)
+        , compiled(false)
+        , dirty(true)
+        , first(true)
+    {}
+
+    virtual ~RenderListNode() { delete[] runNodes; }
+
+    // Compile again when the source scene changed.
+    void Invalidate() { compiled = false; }
+
+    void VisitSubNodes(ISceneNodeVisitor& visitor) {
+        if (!compiled) Compile();
+        if (dirty) Update();
+        for (unsigned int i = 0; i < runs.size(); i++) {
+            if (runs[i].transform < 0)
+                VisitItems(runs[i].begin, runs[i].end, visitor);
+            else
+                runNodes[i].Accept(visitor);
+        }
+    }
+
+    // A new frame starts, check the transformations at the next visit.
+    void Handle(ProcessEventArg arg) { dirty = true; }
+};
+
+#endif
@@ -0,0 +1,258 @@
+#ifndef _SCENE_CACHE_
+#define _SCENE_CACHE_
+
+#include <Resources/BinaryStreamArchive.h>
+#include <Resources/DirectoryManager.h>
+#include <Scene/ISceneNode.h>
+#include <Logging/Logger.h>
+
+#include "MappedFile.h"
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#if defined(_WIN32)
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+
+using OpenEngine::Resources::BinaryStreamArchiveReader;
+using OpenEngine::Resources::BinaryStreamArchiveWriter;
+using OpenEngine::Resources::DirectoryManager;
+using OpenEngine::Scene::ISceneNode;
+
+typedef unsigned long long CacheHash;
+
+/**
+ * Incremental 64 bit FNV-1a hash used to key the scene caches.
+ */
+class CacheKey {
+private:
+    CacheHash hash;
+
+public:
+    CacheKey() : hash(14695981039346656037ULL) {}
+
+    CacheHash Get() const { return hash; }
+
+    void Add(const char* data, unsigned long size) {
+        for (unsigned long i = 0; i < size; i++) {
+            hash ^= (unsigned char)data[i];
+            hash *= 1099511628211ULL;
+        }
+    }
+
+    void Add(std::string str) {
+        Add(str.c_str(), str.size() + 1);
+    }
+
+    void Add(unsigned int value) {
+        std::ostringstream os;
+        os << value;
+        Add(os.str());
+    }
+
+    void Add(float value) {
+        std::ostringstream os;
+        os << value;
+        Add(os.str());
+    }
+
+    /**
+     * Hash the name and the contents of a file found in the data
+     * path. A missing file is hashed by name only.
+     */
+    void AddFile(std::string file) {
+        Add(file);
+        std::ifstream in(DirectoryManager::FindFileInPath(file).c_str(),
+                         std::ios::binary);
+        char buf[64*1024];
+        while (in.good()) {
+            in.read(buf, sizeof(buf));
+            Add(buf, in.gcount());
+        }
+    }
+
+    static std::string ToString(CacheHash hash) {
+        char buf[17];
+        sprintf(buf, "%016llx", hash);
+        return buf;
+    }
+};
+
+/**
+ * A directory of serialized scenes, keyed by a hash of everything the
+ * scene was built from.
+ *
+ * Each file starts with a header holding a magic number, the format
+ * version, the key and the size and hash of the archive that follows.
+ * A file is only used when all of them match. Files are written to a
+ * temporary name first and then renamed into place, so a reader never
+ * sees a partially written cache.
+ */
+class SceneCache {
+private:
+    std::string dir;
+
+    static const unsigned int VERSION = 1;
+
+    // The archive in a mapped cache file, or NULL if the file is
+    // missing or does not match the key.
+    static const char* Validate(MappedFile& file, std::string path,
+                                CacheHash key, unsigned long& size) {
+        if (!file.IsOpen()) return NULL;
+
+        const unsigned long headerSize = 4 + 4*8;
+        if (file.GetSize() < headerSize) {
+            logger.warning << "Ignoring truncated scene cache: " << path
+                           << logger.end;
+            return NULL;
+        }
+        MemoryInputStream header(file.GetData(), headerSize);
+        char magic[4];
+        header.read(magic, 4);
+        CacheHash version     = ReadHash(header);
+        CacheHash fileKey     = ReadHash(header);
+        CacheHash payloadSize = ReadHash(header);
+        CacheHash sum         = ReadHash(header);
+        if (std::string(magic, 4) != "OESC" || version != VERSION ||
+            fileKey != key || payloadSize != file.GetSize() - headerSize) {
+            logger.warning << "Ignoring invalid scene cache: " << path
+                           << logger.end;
+            return NULL;
+        }
+
+        const char* payload = file.GetData() + headerSize;
+        CacheKey check;
+        check.Add(payload, payloadSize);
+        if (check.Get() != sum) {
+            logger.warning << "Ignoring corrupt scene cache: " << path
+                           << logger.end;
+            return NULL;
+        }
+        size = payloadSize;
+        return payload;
+    }
+
+public:
+    /**
+     * Little endian 64 bit header fields, shared with the other files
+     * kept in the cache directory.
+     */
+    static void WriteHash(std::ostream& os, CacheHash v) {
+        for (unsigned int i = 0; i < 8; i++)
+            os.put((char)((v >> (8*i)) & 0xFF));
+    }
+    static CacheHash ReadHash(std::istream& is) {
+        CacheHash v = 0;
+        for (unsigned int i = 0; i < 8; i++)
+            v |= ((CacheHash)(unsigned char)is.get()) << (8*i);
+        return v;
+    }
+
+    SceneCache(std::string dir) : dir(dir) {
+        if (this->dir.empty()) this->dir = ".";
+    }
+
+    std::string GetPath(std::string name, CacheHash key) const {
+        return dir + "/oeracer-" + name + "-" + CacheKey::ToString(key) + ".bin";
+    }
+
+    /**
+     * Load a cached scene. Returns NULL if no valid cache exists for
+     * the key.
+     *
+     * The file is memory mapped and the archive is read straight from
+     * the mapped pages, so no copy of the file is made on the heap and
+     * processes loading the same cache share its pages.
+     */
+    ISceneNode* Load(std::string name, CacheHash key) {
+        std::string path = GetPath(name, key);
+        MappedFile file(path);
+        unsigned long size;
+        const char* payload = Validate(file, path, key, size);
+        if (payload == NULL) return NULL;
+        MemoryInputStream is(payload, size);
+        BinaryStreamArchiveReader reader(is);
+        return reader.ReadScene(name);
+    }
+
+    /**
+     * Read and validate the archive of a cached scene without parsing
+     * it, so the file access can be done on another thread. Returns
+     * false if no valid cache exists for the key.
+     */
+    bool Read(std::string name, CacheHash key, std::string& payload) {
+        std::string path = GetPath(name, key);
+        MappedFile file(path);
+        unsigned long size;
+        const char* data = Validate(file, path, key, size);
+        if (data == NULL) return false;
+        payload.assign(data, size);
+        return true;
+    }
+
+    /**
+     * The archive of a scene, as stored in the cache.
+     */
+    static std::string Serialize(std::string name, ISceneNode* scene) {
+        std::ostringstream os(std::ios::out | std::ios::binary);
+        {
+            BinaryStreamArchiveWriter writer(os);
+            writer.WriteScene(name, scene);
+        }
+        return os.str();
+    }
+
+    /**
+     * Parse an archive returned by Read or Serialize.
+     */
+    static ISceneNode* Parse(std::string name, const std::string& payload) {
+        MemoryInputStream is(payload.data(), payload.size());
+        BinaryStreamArchiveReader reader(is);
+        return reader.ReadScene(name);
+    }
+
+    /**
+     * Serialize a scene into the cache under the given key.
+     */
+    bool Save(std::string name, CacheHash key, ISceneNode* scene) {
+        std::string payload = Serialize(name, scene);
+        CacheKey sum;
+        sum.Add(payload.data(), payload.size());
+
+        std::string path = GetPath(name, key);
+        std::ostringstream tmp;
+        tmp << path << ".tmp" << getpid();
+        std::ofstream of(tmp.str().c_str(), std::ios::binary | std::ios::trunc);
+        of.write("OESC", 4);
+        WriteHash(of, VERSION);
+        WriteHash(of, key);
+        WriteHash(of, payload.size());
+        WriteHash(of, sum.Get());
+        of.write(payload.data(), payload.size());
+        of.close();
+        if (!of.good()) {
+            logger.error << "Could not write scene cache: " << tmp.str()
+                         << logger.end;
+            remove(tmp.str().c_str());
+            return false;
+        }
+#if defined(_WIN32)
+        remove(path.c_str());
+#endif
+        if (rename(tmp.str().c_str(), path.c_str()) != 0) {
+            logger.error << "Could not move scene cache into place: " << path
+                         << logger.end;
+            remove(tmp.str().c_str());
+            return false;
+        }
+        return true;
+    }
+};
+
+#endif
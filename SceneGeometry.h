@@ -0,0 +1,369 @@
+#ifndef _SCENE_GEOMETRY_
+#define _SCENE_GEOMETRY_
+
+#include <Scene/ISceneNode.h>
+#include <Scene/ISceneNodeVisitor.h>
+#include <Scene/SceneNode.h>
+#include <Scene/GeometryNode.h>
+#include <Scene/TransformationNode.h>
+#include <Scene/QuadNode.h>
+#include <Scene/BSPNode.h>
+#include <Geometry/Face.h>
+#include <Geometry/FaceSet.h>
+#include <Geometry/Material.h>
+#include <Logging/Logger.h>
+
+#include <algorithm>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+using OpenEngine::Scene::ISceneNode;
+using OpenEngine::Scene::ISceneNodeVisitor;
+using OpenEngine::Scene::SceneNode;
+using OpenEngine::Scene::GeometryNode;
+using OpenEngine::Scene::TransformationNode;
+using OpenEngine::Scene::QuadNode;
+using OpenEngine::Scene::BSPNode;
+using OpenEngine::Geometry::Face;
+using OpenEngine::Geometry::FacePtr;
+using OpenEngine::Geometry::FaceSet;
+using OpenEngine::Geometry::FaceList;
+using OpenEngine::Geometry::Material;
+using OpenEngine::Geometry::MaterialPtr;
+
+/**
+ * Collects the faces of all geometry nodes below a node into a new
+ * geometry node. The faces are shared, not copied, so the new node
+ * costs one pointer per face.
+ */
+class SharedGeometryCollector : public ISceneNodeVisitor {
+private:
+    FaceSet* faces;
+
+public:
+    SharedGeometryCollector() : faces(NULL) {}
+
+    GeometryNode* Collect(ISceneNode& node) {
+        faces = new FaceSet();
+        node.Accept(*this);
+        GeometryNode* geom = new GeometryNode(faces);
+        faces = NULL;
+        return geom;
+    }
+
+    void VisitGeometryNode(GeometryNode* node) {
+        FaceSet* fs = node->GetFaceSet();
+        if (fs != NULL)
+            for (FaceList::iterator itr = fs->begin(); itr != fs->end(); itr++)
+                faces->Add(*itr);
+        node->VisitSubNodes(*this);
+    }
+};
+
+/**
+ * Counts the geometry held by a scene, in geometry nodes and in the
+ * dividers and spans of BSP nodes. Faces seen by a previous call to
+ * Count are not counted again, so counting several scenes with the
+ * same visitor reports faces shared between them once.
+ */
+class SceneMemoryVisitor : public ISceneNodeVisitor {
+private:
+    std::set<Face*> seen;
+    unsigned int geometryNodes, bspNodes, spans, faces, sharedFaces;
+
+    void Add(Face* face) {
+        faces++;
+        if (!seen.insert(face).second) sharedFaces++;
+    }
+
+    void Add(FaceSet* fs) {
+        if (fs == NULL) return;
+        for (FaceList::iterator itr = fs->begin(); itr != fs->end(); itr++)
+            Add(itr->get());
+    }
+
+public:
+    SceneMemoryVisitor()
+        : geometryNodes(0), bspNodes(0), spans(0), faces(0), sharedFaces(0) {}
+
+    void Count(ISceneNode* node) {
+        geometryNodes = bspNodes = spans = faces = sharedFaces = 0;
+        if (node != NULL) node->Accept(*this);
+    }
+
+    unsigned int GetGeometryNodes() const { return geometryNodes; }
+    unsigned int GetBSPNodes() const { return bspNodes; }
+    unsigned int GetFaces() const { return faces; }
+    unsigned int GetSharedFaces() const { return sharedFaces; }
+
+    // Bytes of face data owned by the last counted scene.
+    unsigned long GetBytes() const {
+        return (unsigned long)(faces - sharedFaces) * sizeof(Face)
+            + (unsigned long)faces * sizeof(FacePtr)
+            + (unsigned long)geometryNodes * (sizeof(GeometryNode) + sizeof(FaceSet))
+            + (unsigned long)bspNodes * sizeof(BSPNode)
+            + (unsigned long)spans * sizeof(FaceSet);
+    }
+
+    void Log(std::string name, ISceneNode* node) {
+        Count(node);
+        logger.info << name << ": " << GetGeometryNodes() << " geometry nodes, "
+                    << GetBSPNodes() << " BSP nodes, " << GetFaces() << " faces (" << GetSharedFaces()
+                    << " shared), " << GetBytes() / 1024 << " KB"
+                    << logger.end;
+    }
+
+    void VisitGeometryNode(GeometryNode* node) {
+        geometryNodes++;
+        Add(node->GetFaceSet());
+        node->VisitSubNodes(*this);
+    }
+
+    void VisitBSPNode(BSPNode* node) {
+        bspNodes++;
+        if (node->GetDivider()) Add(node->GetDivider().get());
+        if (node->GetSpan() != NULL) spans++;
+        Add(node->GetSpan());
+        if (node->GetFront() != NULL) node->GetFront()->Accept(*this);
+        if (node->GetBack()  != NULL) node->GetBack()->Accept(*this);
+    }
+};
+
+/**
+ * The contents of a material that decide its render state, so equal
+ * materials loaded by different models compare equal. Textures and
+ * shaders are compared by resource, which the resource manager shares
+ * between all users of the same file.
+ */
+struct MaterialKey {
+    float values[17]; // diffuse, ambient, specular, emission, shininess
+    void* texture;
+    void* shader;
+
+    MaterialKey(Material* m) : texture(NULL), shader(NULL) {
+        std::fill(values, values + 17, 0.0f);
+        if (m == NULL) return;
+        for (unsigned int i = 0; i < 4; i++) {
+            values[i]    = m->diffuse[i];
+            values[4+i]  = m->ambient[i];
+            values[8+i]  = m->specular[i];
+            values[12+i] = m->emission[i];
+        }
+        values[16] = m->shininess;
+        texture = m->texr.get();
+        shader = m->shad.get();
+    }
+
+    bool operator==(const MaterialKey& other) const {
+        return texture == other.texture && shader == other.shader &&
+            std::equal(values, values + 17, other.values);
+    }
+    bool operator!=(const MaterialKey& other) const { return !(*this == other); }
+};
+
+/**
+ * Estimates the draw calls and material changes of rendering a scene.
+ * The vertex array transformer makes one vertex array per material of
+ * a geometry node, so every distinct material of a node is one draw
+ * call, and a state change when it differs from the previous call.
+ * Materials are compared by contents.
+ */
+class DrawCallCounter : public ISceneNodeVisitor {
+private:
+    unsigned int geometryNodes, drawCalls, stateChanges;
+    MaterialKey last;
+
+public:
+    DrawCallCounter() : geometryNodes(0), drawCalls(0), stateChanges(0), last(NULL) {}
+
+    void Count(ISceneNode* node) {
+        geometryNodes = drawCalls = stateChanges = 0;
+        last = MaterialKey(NULL);
+        if (node != NULL) node->Accept(*this);
+    }
+
+    unsigned int GetGeometryNodes() const { return geometryNodes; }
+    unsigned int GetDrawCalls() const { return drawCalls; }
+    unsigned int GetStateChanges() const { return stateChanges; }
+
+    void VisitGeometryNode(GeometryNode* node) {
+        geometryNodes++;
+        std::vector<MaterialKey> materials;
+        FaceSet* fs = node->GetFaceSet();
+        if (fs != NULL)
+            for (FaceList::iterator itr = fs->begin(); itr != fs->end(); itr++) {
+                MaterialKey m((*itr)->mat.get());
+                if (std::find(materials.begin(), materials.end(), m) == materials.end())
+                    materials.push_back(m);
+            }
+        for (unsigned int i = 0; i < materials.size(); i++) {
+            drawCalls++;
+            if (materials[i] != last) stateChanges++;
+            last = materials[i];
+        }
+        node->VisitSubNodes(*this);
+    }
+};
+
+/**
+ * The shape of a partitioned tree: its nodes by kind, its depth and
+ * the face references held by geometry nodes and BSP nodes, the same
+ * nodes ASDotVisitor draws in its graphs.
+ */
+class TreeStats : public ISceneNodeVisitor {
+private:
+    unsigned int depth;
+
+    void Enter() {
+        nodes++;
+        depth++;
+        if (depth > maxDepth) maxDepth = depth;
+    }
+
+    void Add(FaceSet* fs) {
+        if (fs != NULL) faces += fs->Size();
+    }
+
+public:
+    unsigned int nodes, quadNodes, bspNodes, geometryNodes, transformationNodes, maxDepth;
+    unsigned long faces;
+
+    TreeStats() { Count(NULL); }
+
+    void Count(ISceneNode* node) {
+        depth = nodes = quadNodes = bspNodes = geometryNodes = transformationNodes = maxDepth = 0;
+        faces = 0;
+        if (node != NULL) node->Accept(*this);
+    }
+
+    void Log(std::string name, ISceneNode* node) {
+        Count(node);
+        logger.info << name << ": " << nodes << " nodes (" << quadNodes
+                    << " quad, " << bspNodes << " BSP, " << geometryNodes
+                    << " geometry), depth " << maxDepth << ", " << faces
+                    << " face references" << logger.end;
+    }
+
+    void VisitSceneNode(SceneNode* node) {
+        Enter();
+        node->VisitSubNodes(*this);
+        depth--;
+    }
+
+    void VisitTransformationNode(TransformationNode* node) {
+        Enter();
+        transformationNodes++;
+        node->VisitSubNodes(*this);
+        depth--;
+    }
+
+    void VisitQuadNode(QuadNode* node) {
+        Enter();
+        quadNodes++;
+        node->VisitSubNodes(*this);
+        depth--;
+    }
+
+    void VisitBSPNode(BSPNode* node) {
+        Enter();
+        bspNodes++;
+        if (node->GetDivider()) faces++;
+        Add(node->GetSpan());
+        if (node->GetFront() != NULL) node->GetFront()->Accept(*this);
+        if (node->GetBack()  != NULL) node->GetBack()->Accept(*this);
+        depth--;
+    }
+
+    void VisitGeometryNode(GeometryNode* node) {
+        Enter();
+        geometryNodes++;
+        Add(node->GetFaceSet());
+        node->VisitSubNodes(*this);
+        depth--;
+    }
+};
+
+/**
+ * Merges the geometry nodes that share a parent, such as the pieces of
+ * different models in one quad tree cell, into a single geometry node
+ * with its faces grouped by material. Faces with equal materials are
+ * given the first such material, so each material of a cell then
+ * becomes one vertex array. The materials are ordered the same way in
+ * every cell, so neighbouring cells tend to continue with the material
+ * the previous one ended with.
+ */
+class StaticBatcher : public ISceneNodeVisitor {
+private:
+    std::vector<ISceneNode*> parents;
+    std::map<ISceneNode*, std::vector<GeometryNode*> > children;
+    std::vector<MaterialKey> order; // first appearance in the scene
+    std::vector<MaterialPtr> shared; // the material used for each key
+
+    unsigned int MaterialIndex(MaterialPtr material) {
+        MaterialKey m(material.get());
+        std::vector<MaterialKey>::iterator itr = std::find(order.begin(), order.end(), m);
+        if (itr != order.end()) return itr - order.begin();
+        order.push_back(m);
+        shared.push_back(material);
+        return order.size() - 1;
+    }
+
+public:
+    void Batch(ISceneNode& root) {
+        DrawCallCounter before, after;
+        before.Count(&root);
+
+        parents.clear();
+        children.clear();
+        root.Accept(*this);
+
+        for (unsigned int p = 0; p < parents.size(); p++) {
+            ISceneNode* parent = parents[p];
+            std::vector<GeometryNode*>& geoms = children[parent];
+
+            // bucket the faces of the cell by material
+            std::vector< std::vector<FacePtr> > buckets;
+            for (unsigned int g = 0; g < geoms.size(); g++) {
+                FaceSet* fs = geoms[g]->GetFaceSet();
+                if (fs == NULL) continue;
+                for (FaceList::iterator itr = fs->begin(); itr != fs->end(); itr++) {
+                    unsigned int m = MaterialIndex((*itr)->mat);
+                    (*itr)->mat = shared[m];
+                    if (m >= buckets.size()) buckets.resize(m + 1);
+                    buckets[m].push_back(*itr);
+                }
+            }
+
+            FaceSet* merged = new FaceSet();
+            for (unsigned int m = 0; m < buckets.size(); m++)
+                for (unsigned int f = 0; f < buckets[m].size(); f++)
+                    merged->Add(buckets[m][f]);
+            for (unsigned int g = 0; g < geoms.size(); g++) {
+                parent->RemoveNode(geoms[g]);
+                delete geoms[g];
+            }
+            parent->AddNode(new GeometryNode(merged));
+        }
+
+        after.Count(&root);
+        logger.info << "Static batching: " << before.GetGeometryNodes()
+                    << " geometry nodes, " << before.GetDrawCalls()
+                    << " draw calls, " << before.GetStateChanges()
+                    << " state changes -> " << after.GetGeometryNodes()
+                    << " geometry nodes, " << after.GetDrawCalls()
+                    << " draw calls, " << after.GetStateChanges()
+                    << " state changes" << logger.end;
+    }
+
+    void VisitGeometryNode(GeometryNode* node) {
+        ISceneNode* parent = node->GetParent();
+        if (parent == NULL) return;
+        if (children.find(parent) == children.end())
+            parents.push_back(parent);
+        children[parent].push_back(node);
+    }
+};
+
+#endif
@@ -0,0 +1,152 @@
+#ifndef _STARTUP_REPORT_
+#define _STARTUP_REPORT_
+
+#include <Utils/Timer.h>
+#include <Logging/Logger.h>
+
+#include "AllocationCounter.h"
+
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#if !defined(_WIN32)
+#include <sys/resource.h>
+#endif
+
+using OpenEngine::Utils::Timer;
+
+/**
+ * Collects wall time, peak resident set size and allocation count for
+ * the startup phases, the loaded models and the scene transformations,
+ * and writes them as JSON.
+ */
+class StartupReport {
+public:
+    enum Category { PHASE, MODEL, TRANSFORM };
+
+    struct Entry {
+        Category category;
+        std::string name;
+        unsigned int time;         // microseconds
+        unsigned long peakRSS;     // KB
+        unsigned long allocations;
+    };
+
+    /**
+     * Measures one entry from construction until End() or destruction.
+     */
+    class Scope {
+    private:
+        StartupReport& report;
+        Category category;
+        std::string name;
+        unsigned long allocations;
+        Timer timer;
+        bool done;
+    public:
+        Scope(StartupReport& report, Category category, std::string name)
+            : report(report), category(category), name(name)
+            , allocations(GetAllocationCount()), done(false) {
+            timer.Start();
+        }
+        ~Scope() { End(); }
+        void End() {
+            if (done) return;
+            done = true;
+            report.Add(category, name, timer.GetElapsedTime().AsInt(),
+                       GetAllocationCount() - allocations);
+        }
+    };
+
+private:
+    std::vector<Entry> entries;
+    Timer total;
+
+    // A string as the contents of a JSON string literal.
+    static std::string Escape(std::string str) {
+        std::string out;
+        for (unsigned int i = 0; i < str.size(); i++) {
+            unsigned char c = str[i];
+            if (c == '"' || c == '\\') {
+                out += '\\';
+                out += c;
+            }
+            else if (c < 0x20) {
+                char buf[7];
+                sprintf(buf, "\\u%04x", c);
+                out += buf;
+            }
+            else out += c;
+        }
+        return out;
+    }
+
+public:
+    StartupReport() {
+        total.Start();
+    }
+
+    // Peak resident set size of the process in KB, 0 if unknown.
+    static unsigned long PeakRSS() {
+#if defined(_WIN32)
+        return 0;
+#else
+        struct rusage usage;
+        if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+#if defined(__APPLE__)
+        return usage.ru_maxrss / 1024;
+#else
+        return usage.ru_maxrss;
+#endif
+#endif
+    }
+
+    void Add(Category category, std::string name, unsigned int time,
+             unsigned long allocations) {
+        Entry e;
+        e.category = category;
+        e.name = name;
+        e.time = time;
+        e.peakRSS = PeakRSS();
+        e.allocations = allocations;
+        entries.push_back(e);
+        if (category != MODEL)
+            logger.info << "Startup " << name << ": " << time / 1000 << " ms, "
+                        << allocations << " allocations, peak RSS "
+                        << e.peakRSS / 1024 << " MB" << logger.end;
+    }
+
+    void Write(std::string file) const {
+        std::ofstream out(file.c_str());
+        if (!out.good()) {
+            logger.error << "Can not open '" << file << "' for output"
+                         << logger.end;
+            return;
+        }
+        const char* keys[] = { "phases", "models", "transforms" };
+        out << "{\n  \"total_ms\": " << total.GetElapsedTime().AsInt() / 1000.0
+            << ",\n  \"peak_rss_kb\": " << PeakRSS();
+        for (unsigned int c = PHASE; c <= TRANSFORM; c++) {
+            out << ",\n  \"" << keys[c] << "\": [";
+            bool first = true;
+            for (unsigned int i = 0; i < entries.size(); i++) {
+                const Entry& e = entries[i];
+                if (e.category != (Category)c) continue;
+                out << (first ? "\n" : ",\n")
+                    << "    {\"name\": \"" << Escape(e.name) << "\""
+                    << ", \"wall_ms\": " << e.time / 1000.0
+                    << ", \"peak_rss_kb\": " << e.peakRSS
+                    << ", \"allocations\": " << e.allocations << "}";
+                first = false;
+            }
+            out << "\n  ]";
+        }
+        out << "\n}\n";
+        logger.info << "Saved the startup report to '" << file << "'"
+                    << logger.end;
+    }
+};
+
+#endif
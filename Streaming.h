@@ -0,0 +1,481 @@
+#ifndef _STREAMING_
+#define _STREAMING_
+
+#include <Core/IModule.h>
+#include <Core/Thread.h>
+#include <Core/Mutex.h>
+#include <Display/IViewingVolume.h>
+#include <Scene/ISceneNode.h>
+#include <Scene/ISceneNodeVisitor.h>
+#include <Scene/SceneNode.h>
+#include <Scene/GeometryNode.h>
+#include <Scene/TransformationNode.h>
+#include <Scene/VertexArrayTransformer.h>
+#include <Geometry/Face.h>
+#include <Geometry/FaceSet.h>
+#include <Math/Vector.h>
+#include <Utils/Timer.h>
+#include <Logging/Logger.h>
+
+#include "SceneCache.h"
+#include "RenderList.h"
+#include "Views.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdio>
+#include <deque>
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+
+using OpenEngine::Core::IModule;
+using OpenEngine::Core::Thread;
+using OpenEngine::Core::Mutex;
+using OpenEngine::Core::InitializeEventArg;
+using OpenEngine::Core::ProcessEventArg;
+using OpenEngine::Core::DeinitializeEventArg;
+using OpenEngine::Display::IViewingVolume;
+using OpenEngine::Scene::ISceneNode;
+using OpenEngine::Scene::ISceneNodeVisitor;
+using OpenEngine::Scene::SceneNode;
+using OpenEngine::Scene::GeometryNode;
+using OpenEngine::Scene::TransformationNode;
+using OpenEngine::Scene::VertexArrayTransformer;
+using OpenEngine::Geometry::FaceSet;
+using OpenEngine::Geometry::FaceList;
+using OpenEngine::Math::Vector;
+using OpenEngine::Utils::Timer;
+
+/**
+ * A square tile of the static scene, stored in the scene cache.
+ */
+struct TileInfo {
+    int x, z;
+    float min[3], max[3];
+    unsigned long bytes; // of the serialized tile
+};
+
+/**
+ * Streams tiles of the static scene in and out around a followed node.
+ *
+ * Cut splits a partitioned static scene into square tiles on the
+ * ground plane and stores each tile and an index of all tiles in the
+ * scene cache. At run time tiles near the followed node, near where
+ * its velocity takes it within the lookahead time, and tiles seen by
+ * the views within the view distance are loaded, nearest first, until
+ * the memory budget is used. Tiles no longer wanted are dropped.
+ *
+ * Reading and validating tile files runs on a loader thread. The
+ * archive is parsed, and turned into vertex arrays, on the main thread
+ * as it may create texture resources, at most one tile per frame.
+ */
+class TileStreamer : public Thread, public IModule {
+private:
+    enum State { UNLOADED, QUEUED, LOADED, FAILED };
+
+    SceneCache cache;
+    CacheHash key;
+    std::vector<TileInfo> tiles;
+    ISceneNode& parent;
+    TransformationNode* target;
+    RenderListNode* renderList;
+    std::vector<IViewingVolume*> views;
+
+    unsigned long budget;
+    float radius, viewDistance, lookahead;
+
+    // main thread state
+    std::vector<State> state;
+    std::vector<ISceneNode*> nodes;
+    unsigned long loadedBytes;
+    unsigned int loads, unloads;
+    Vector<3,float> lastPosition, velocity;
+    Timer timer;
+
+    // shared with the loader thread
+    Mutex lock;
+    std::deque<unsigned int> requests;
+    std::deque<unsigned int> ready;
+    std::map<unsigned int, std::string> payloads;
+    volatile bool running;
+
+    class Collector : public ISceneNodeVisitor {
+    public:
+        std::vector<GeometryNode*> nodes;
+        void VisitGeometryNode(GeometryNode* node) {
+            nodes.push_back(node);
+        }
+    };
+
+    static const unsigned int INDEX_VERSION = 1;
+    static const unsigned long INDEX_HEADER_SIZE = 4 + 4*8;
+
+    // Write the index of tiles with a header like the scene cache
+    // files: magic, version, key, tile count and hash of the tiles.
+    static bool WriteIndex(SceneCache& cache, CacheHash key,
+                           const std::vector<TileInfo>& tiles) {
+        const char* data = tiles.empty() ? NULL : (const char*)&tiles[0];
+        unsigned long size = sizeof(TileInfo) * tiles.size();
+        CacheKey sum;
+        sum.Add(data, size);
+
+        std::string path = cache.GetPath("tiles", key);
+        std::string tmp = path + ".tmp";
+        std::ofstream of(tmp.c_str(), std::ios::binary | std::ios::trunc);
+        of.write("OETI", 4);
+        SceneCache::WriteHash(of, INDEX_VERSION);
+        SceneCache::WriteHash(of, key);
+        SceneCache::WriteHash(of, tiles.size());
+        SceneCache::WriteHash(of, sum.Get());
+        if (size > 0) of.write(data, size);
+        of.close();
+#if defined(_WIN32)
+        remove(path.c_str());
+#endif
+        if (!of.good() || rename(tmp.c_str(), path.c_str()) != 0) {
+            logger.error << "Could not write tile index: " << path
+                         << logger.end;
+            remove(tmp.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    static CacheHash TileKey(CacheHash key, const TileInfo& tile) {
+        CacheKey k;
+        k.Add((const char*)&key, sizeof(key));
+        k.Add((unsigned int)tile.x);
+        k.Add((unsigned int)tile.z);
+        return k.Get();
+    }
+
+    // Distance from p to the box of a tile.
+    static float Distance(const TileInfo& t, Vector<3,float> p) {
+        float d2 = 0.0f;
+        for (unsigned int k = 0; k < 3; k++) {
+            float d = std::max(std::max(t.min[k] - p[k], p[k] - t.max[k]), 0.0f);
+            d2 += d * d;
+        }
+        return std::sqrt(d2);
+    }
+
+    // Planes as six times (a,b,c,d), see GetFrustumPlanes.
+    static bool InFrustum(const TileInfo& t, const float* planes) {
+        for (unsigned int p = 0; p < 6; p++, planes += 4) {
+            float d = planes[3];
+            for (unsigned int k = 0; k < 3; k++)
+                d += std::max(planes[k] * t.min[k], planes[k] * t.max[k]);
+            if (d < 0) return false;
+        }
+        return true;
+    }
+
+    void Unload(unsigned int i) {
+        parent.RemoveNode(nodes[i]);
+        delete nodes[i];
+        nodes[i] = NULL;
+        state[i] = UNLOADED;
+        loadedBytes -= tiles[i].bytes;
+        unloads++;
+    }
+
+    // Parse a tile read by the loader thread and add it to the scene.
+    bool Integrate(unsigned int i, const std::string& payload, bool wanted) {
+        if (!wanted || state[i] != QUEUED) {
+            if (state[i] == QUEUED) state[i] = UNLOADED;
+            return false;
+        }
+        ISceneNode* node = payload.empty() ? NULL : SceneCache::Parse("tile", payload);
+        if (node == NULL) {
+            logger.warning << "Could not load tile " << tiles[i].x << ","
+                           << tiles[i].z << logger.end;
+            state[i] = FAILED;
+            return false;
+        }
+        VertexArrayTransformer vaT;
+        vaT.Transform(*node);
+        parent.AddNode(node);
+        nodes[i] = node;
+        state[i] = LOADED;
+        loadedBytes += tiles[i].bytes;
+        loads++;
+        return true;
+    }
+
+public:
+    /**
+     * Stream the tiles of the index stored under key into parent,
+     * around the target node.
+     */
+    TileStreamer(std::string cacheDir, CacheHash key, std::vector<TileInfo> tiles,
+                 ISceneNode& parent, TransformationNode* target)
+        : cache(cacheDir)
+        , key(key)
+        , tiles(tiles)
+        , parent(parent)
+        , target(target)
+        , renderList(NULL)
+        , budget(64 * 1024 * 1024)
+        , radius(300.0f)
+        , viewDistance(1000.0f)
+        , lookahead(2.0f)
+        , state(tiles.size(), UNLOADED)
+        , nodes(tiles.size(), (ISceneNode*)NULL)
+        , loadedBytes(0)
+        , loads(0)
+        , unloads(0)
+        , running(false)
+    {}
+
+    /**
+     * Cut the geometry nodes below scene into tiles of the given size
+     * by the center of their bounds, store them and an index in the
+     * cache and remove them from the scene. The tiles are returned in
+     * tiles. Returns false, leaving the scene as it was, if a tile or
+     * the index could not be saved.
+     */
+    static bool Cut(ISceneNode& scene, float size, std::string cacheDir,
+                    CacheHash key, std::vector<TileInfo>& tiles) {
+        SceneCache cache(cacheDir);
+        Collector c;
+        scene.Accept(c);
+
+        std::map<std::pair<int,int>, unsigned int> index;
+        std::vector<TileInfo> cut;
+        std::vector< std::vector<GeometryNode*> > members;
+        for (unsigned int i = 0; i < c.nodes.size(); i++) {
+            GeometryNode* geom = c.nodes[i];
+            FaceSet* fs = geom->GetFaceSet();
+            if (fs == NULL || geom->GetParent() == NULL) continue;
+
+            float lo[3] = {  FLT_MAX,  FLT_MAX,  FLT_MAX };
+            float hi[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+            for (FaceList::iterator itr = fs->begin(); itr != fs->end(); itr++)
+                for (unsigned int v = 0; v < 3; v++)
+                    for (unsigned int k = 0; k < 3; k++) {
+                        lo[k] = std::min(lo[k], (*itr)->vert[v][k]);
+                        hi[k] = std::max(hi[k], (*itr)->vert[v][k]);
+                    }
+            if (lo[0] > hi[0]) continue;
+
+            std::pair<int,int> cell((int)std::floor((lo[0] + hi[0]) * 0.5f / size),
+                                    (int)std::floor((lo[2] + hi[2]) * 0.5f / size));
+            if (index.find(cell) == index.end()) {
+                TileInfo t;
+                t.x = cell.first;
+                t.z = cell.second;
+                for (unsigned int k = 0; k < 3; k++) {
+                    t.min[k] = FLT_MAX;
+                    t.max[k] = -FLT_MAX;
+                }
+                t.bytes = 0;
+                index[cell] = cut.size();
+                cut.push_back(t);
+                members.push_back(std::vector<GeometryNode*>());
+            }
+            unsigned int t = index[cell];
+            for (unsigned int k = 0; k < 3; k++) {
+                cut[t].min[k] = std::min(cut[t].min[k], lo[k]);
+                cut[t].max[k] = std::max(cut[t].max[k], hi[k]);
+            }
+            members[t].push_back(geom);
+        }
+
+        // Each tile is saved by moving its nodes under a tile node and
+        // back, so the scene is only changed once everything is stored.
+        bool ok = true;
+        for (unsigned int t = 0; t < cut.size() && ok; t++) {
+            SceneNode tile;
+            std::vector<ISceneNode*> parents;
+            for (unsigned int i = 0; i < members[t].size(); i++) {
+                parents.push_back(members[t][i]->GetParent());
+                parents.back()->RemoveNode(members[t][i]);
+                tile.AddNode(members[t][i]);
+            }
+            CacheHash tileKey = TileKey(key, cut[t]);
+            ok = cache.Save("tile", tileKey, &tile);
+            for (unsigned int i = 0; i < members[t].size(); i++) {
+                tile.RemoveNode(members[t][i]);
+                parents[i]->AddNode(members[t][i]);
+            }
+            std::ifstream in(cache.GetPath("tile", tileKey).c_str(),
+                             std::ios::binary | std::ios::ate);
+            cut[t].bytes = in.good() ? (unsigned long)in.tellg() : 0;
+        }
+        // the index is written last, so it only exists with all tiles
+        if (!ok || !WriteIndex(cache, key, cut)) return false;
+
+        for (unsigned int t = 0; t < cut.size(); t++)
+            for (unsigned int i = 0; i < members[t].size(); i++) {
+                members[t][i]->GetParent()->RemoveNode(members[t][i]);
+                delete members[t][i];
+            }
+        tiles.swap(cut);
+        logger.info << "Cut the static scene into " << tiles.size() << " tiles"
+                    << logger.end;
+        return true;
+    }
+
+    /**
+     * Read the tile index stored under key. Returns false if there is
+     * none or it is not valid.
+     */
+    static bool ReadIndex(std::string cacheDir, CacheHash key, std::vector<TileInfo>& tiles) {
+        SceneCache cache(cacheDir);
+        std::string path = cache.GetPath("tiles", key);
+        std::ifstream in(path.c_str(), std::ios::binary | std::ios::ate);
+        if (!in.good()) return false;
+        unsigned long fileSize = (unsigned long)in.tellg();
+        in.seekg(0);
+
+        char magic[4];
+        in.read(magic, 4);
+        CacheHash version = SceneCache::ReadHash(in);
+        CacheHash fileKey = SceneCache::ReadHash(in);
+        CacheHash count   = SceneCache::ReadHash(in);
+        CacheHash sum     = SceneCache::ReadHash(in);
+        if (!in.good() || std::string(magic, 4) != "OETI" ||
+            version != INDEX_VERSION || fileKey != key ||
+            fileSize < INDEX_HEADER_SIZE ||
+            (fileSize - INDEX_HEADER_SIZE) % sizeof(TileInfo) != 0 ||
+            count != (fileSize - INDEX_HEADER_SIZE) / sizeof(TileInfo)) {
+            logger.warning << "Ignoring invalid tile index: " << path
+                           << logger.end;
+            return false;
+        }
+
+        std::vector<TileInfo> read(count);
+        if (count > 0)
+            in.read((char*)&read[0], sizeof(TileInfo) * count);
+        CacheKey check;
+        if (count > 0)
+            check.Add((const char*)&read[0], sizeof(TileInfo) * count);
+        if (!in.good() || check.Get() != sum) {
+            logger.warning << "Ignoring corrupt tile index: " << path
+                           << logger.end;
+            return false;
+        }
+        tiles.swap(read);
+        return true;
+    }
+
+    void SetBudget(unsigned long bytes) { budget = bytes; }
+    void SetRadius(float radius) { this->radius = radius; }
+    void SetViewDistance(float distance) { viewDistance = distance; }
+    void SetLookahead(float seconds) { lookahead = seconds; }
+
+    // Invalidate the render list when tiles come and go.
+    void SetRenderList(RenderListNode* list) { renderList = list; }
+
+    void AddView(IViewingVolume* view) { views.push_back(view); }
+
+    void Run() {
+        while (running) {
+            lock.Lock();
+            bool idle = requests.empty();
+            unsigned int i = idle ? 0 : requests.front();
+            if (!idle) requests.pop_front();
+            lock.Unlock();
+            if (idle) {
+                Thread::Sleep(1000);
+                continue;
+            }
+            std::string payload;
+            if (!cache.Read("tile", TileKey(key, tiles[i]), payload))
+                payload.clear();
+            lock.Lock();
+            payloads[i].swap(payload);
+            ready.push_back(i);
+            lock.Unlock();
+        }
+    }
+
+    void Handle(InitializeEventArg arg) {
+        if (target != NULL) lastPosition = target->GetPosition();
+        timer.Start();
+        running = true;
+        Start();
+    }
+
+    void Handle(ProcessEventArg arg) {
+        if (target == NULL) return;
+
+        // follow the target and estimate its velocity
+        Vector<3,float> position = target->GetPosition();
+        float dt = timer.GetElapsedTimeAndReset().AsInt() / 1000000.0f;
+        if (dt > 0.0f)
+            velocity = velocity * 0.8f + (position - lastPosition) * (0.2f / dt);
+        lastPosition = position;
+        Vector<3,float> predicted = position + velocity * lookahead;
+
+        // nearest tiles first, those only seen by a view after them
+        std::vector< std::pair<float, unsigned int> > wanted;
+        std::vector<float> frusta(views.size() * 24);
+        for (unsigned int v = 0; v < views.size(); v++) {
+            float planes[6][4];
+            GetFrustumPlanes(*views[v], planes);
+            std::copy(&planes[0][0], &planes[0][0] + 24, &frusta[v * 24]);
+        }
+        for (unsigned int i = 0; i < tiles.size(); i++) {
+            if (state[i] == FAILED) continue;
+            float d = std::min(Distance(tiles[i], position), Distance(tiles[i], predicted));
+            float priority = (d <= radius) ? d : FLT_MAX;
+            for (unsigned int v = 0; v < views.size() && priority == FLT_MAX; v++) {
+                float dv = Distance(tiles[i], views[v]->GetPosition());
+                if (dv <= viewDistance && InFrustum(tiles[i], &frusta[v * 24]))
+                    priority = radius + dv;
+            }
+            if (priority < FLT_MAX)
+                wanted.push_back(std::make_pair(priority, i));
+        }
+        std::sort(wanted.begin(), wanted.end());
+
+        std::vector<char> keep(tiles.size(), 0);
+        unsigned long bytes = 0;
+        for (unsigned int w = 0; w < wanted.size(); w++) {
+            unsigned int i = wanted[w].second;
+            if (bytes + tiles[i].bytes > budget) break;
+            bytes += tiles[i].bytes;
+            keep[i] = 1;
+        }
+
+        bool changed = false;
+        lock.Lock();
+        for (unsigned int i = 0; i < tiles.size(); i++) {
+            if (state[i] == LOADED && !keep[i]) {
+                Unload(i);
+                changed = true;
+            }
+            if (state[i] == UNLOADED && keep[i]) {
+                state[i] = QUEUED;
+                requests.push_back(i);
+            }
+        }
+        bool any = !ready.empty();
+        unsigned int i = any ? ready.front() : 0;
+        std::string payload;
+        if (any) {
+            ready.pop_front();
+            payload.swap(payloads[i]);
+            payloads.erase(i);
+        }
+        lock.Unlock();
+
+        if (any) changed = Integrate(i, payload, keep[i]) || changed;
+        if (changed && renderList != NULL)
+            renderList->Invalidate();
+    }
+
+    void Handle(DeinitializeEventArg arg) {
+        running = false;
+        Wait();
+        logger.info << "Tile streaming: " << loads << " loads, " << unloads
+                    << " unloads, " << loadedBytes / 1024 << " KB resident"
+                    << logger.end;
+    }
+};
+
+#endif
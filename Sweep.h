@@ -0,0 +1,223 @@
+#ifndef _SWEEP_
+#define _SWEEP_
+
+#include <Core/IEngine.h>
+#include <Core/Exceptions.h>
+#include <Scene/ISceneNode.h>
+#include <Scene/TransformationNode.h>
+#include <Physics/FixedTimeStepPhysics.h>
+#include <Physics/RigidBox.h>
+#include <Geometry/Box.h>
+#include <Math/Vector.h>
+#include <Utils/Timer.h>
+
+#include "HeadlessSimulation.h"
+#include "KeyboardHandler.h"
+#include "InputLog.h"
+#include "VehicleFleet.h"
+#include "AIDriver.h"
+#include "WorkerPool.h"
+
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using OpenEngine::Core::IEngine;
+using OpenEngine::Core::Exception;
+using OpenEngine::Scene::ISceneNode;
+using OpenEngine::Scene::TransformationNode;
+using OpenEngine::Physics::RigidBox;
+using OpenEngine::Physics::FixedTimeStepPhysics;
+using OpenEngine::Geometry::Box;
+using OpenEngine::Math::Vector;
+using OpenEngine::Utils::Timer;
+
+/**
+ * The vehicle and physics parameters of one run of a sweep.
+ */
+struct SweepCase {
+    float speed, turn; // control forces of the fleet
+    float gravity;     // downwards acceleration of the rigid box
+    float delta;       // control force scale per physics tick
+};
+
+struct SweepResult {
+    unsigned int lapTicks; // 0 when no lap was completed
+    Vector<3,float> position;
+    double stepsPerSec;
+};
+
+/**
+ * Runs many independent headless worlds on a worker pool, one world
+ * per thread at a time.
+ *
+ * Every world has its own FixedTimeStepPhysics, rigid box, fleet and
+ * controller, while the prebuilt physics tree is shared read only
+ * between them. The vehicle either follows an input trace or the AI
+ * circuit. The lap gate is where the vehicle first gets further than
+ * the lap distance from the start. A lap is complete when it has been
+ * that far from the gate as well and comes back within the lap radius
+ * of it; the lap time counts from the start.
+ */
+class SweepRunner : public IWorkerJob {
+private:
+    WorkerPool pool;
+    ISceneNode* tree;
+    Box body;
+    Vector<3,float> start;
+    IEngine& engine;
+    const InputPlayer* trace;
+    std::vector< Vector<3,float> > waypoints;
+    unsigned int ticks;
+    float lapDistance, lapRadius;
+    std::vector<SweepCase> cases;
+    std::vector<SweepResult> results;
+
+public:
+    SweepRunner(ISceneNode* tree, Box body, Vector<3,float> start,
+                IEngine& engine, unsigned int threads = 0)
+        : pool(threads)
+        , tree(tree)
+        , body(body)
+        , start(start)
+        , engine(engine)
+        , trace(NULL)
+        , ticks(10000)
+        , lapDistance(200.0f)
+        , lapRadius(30.0f)
+    {}
+
+    /**
+     * Drive every world from a copy of the trace instead of the AI.
+     */
+    void SetTrace(const InputPlayer* trace) { this->trace = trace; }
+
+    void SetWaypoints(const std::vector< Vector<3,float> >& waypoints) {
+        this->waypoints = waypoints;
+    }
+
+    void SetTicks(unsigned int ticks) { this->ticks = ticks; }
+
+    void SetLap(float distance, float radius) {
+        lapDistance = distance;
+        lapRadius = radius;
+    }
+
+    unsigned int GetThreadCount() const { return pool.GetThreadCount(); }
+
+    const std::vector<SweepResult>& Run(const std::vector<SweepCase>& cases) {
+        this->cases = cases;
+        results.assign(cases.size(), SweepResult());
+        pool.Run(*this, cases.size());
+        return results;
+    }
+
+    void Execute(unsigned int index) {
+        const SweepCase& c = cases[index];
+        SweepResult& r = results[index];
+        TransformationNode node;
+        RigidBox* box = new RigidBox(body);
+        box->SetCenter(start);
+        box->SetTransformationNode(&node);
+        box->SetGravity(Vector<3,float>(0, -c.gravity, 0));
+        {
+            FixedTimeStepPhysics physics(tree);
+            physics.AddRigidBody(box);
+            VehicleFleet fleet;
+            fleet.Add(box, &node);
+            fleet.SetSpeed(c.speed);
+            fleet.SetTurn(c.turn);
+            fleet.SetFixedDelta(c.delta);
+
+            HeadlessSimulation sim(physics, fleet);
+            KeyboardHandler* handler = NULL;
+            InputPlayer* player = NULL;
+            AIDriver* ai = NULL;
+            if (trace != NULL) {
+                handler = new KeyboardHandler(engine, NULL, &fleet, 0, NULL, NULL);
+                player = new InputPlayer(*trace, *handler);
+                sim.SetInput(handler, player);
+            } else {
+                ai = new AIDriver(fleet);
+                for (unsigned int i = 0; i < waypoints.size(); i++)
+                    ai->AddWaypoint(waypoints[i]);
+                ai->AddVehicle(0);
+                sim.AddController(ai);
+            }
+
+            r.lapTicks = 0;
+            bool gated = false, away = false;
+            Vector<3,float> gate;
+            sim.Initialize();
+            Timer timer;
+            timer.Start();
+            for (unsigned int i = 0; i < ticks; i++) {
+                sim.Step();
+                if (r.lapTicks != 0) continue;
+                Vector<3,float> p = box->GetCenter();
+                Vector<3,float> to = p - (gated ? gate : start);
+                to[1] = 0;
+                float distance = to.GetLength();
+                if (!gated) {
+                    if (distance > lapDistance) {
+                        gate = p;
+                        gated = true;
+                    }
+                }
+                else if (distance > lapDistance) away = true;
+                else if (away && distance < lapRadius) r.lapTicks = i + 1;
+            }
+            double usec = timer.GetElapsedTime().AsInt();
+            r.stepsPerSec = (usec > 0) ? ticks * 1000000.0 / usec : 0;
+            r.position = box->GetCenter();
+            sim.Deinitialize();
+
+            delete ai;
+            delete player;
+            delete handler;
+        }
+        delete box;
+    }
+
+    /**
+     * Read a sweep grid. Every line is a parameter name followed by
+     * the first and last value and the number of values, for instance
+     * "speed 1500 2000 6". The runs are all combinations of the values;
+     * parameters not listed keep their value from base.
+     */
+    static std::vector<SweepCase> ReadGrid(std::string file, SweepCase base) {
+        std::ifstream in(file.c_str());
+        if (!in.good())
+            throw Exception("Can not open sweep grid: " + file);
+
+        std::vector<SweepCase> cases(1, base);
+        std::string line;
+        while (getline(in, line)) {
+            if (line.empty() || line[0] == '#') continue;
+            std::istringstream fields(line);
+            std::string name;
+            float from, to;
+            unsigned int count;
+            if (!(fields >> name >> from >> to >> count) || count == 0)
+                throw Exception("Bad sweep grid line: " + line);
+
+            std::vector<SweepCase> grown;
+            for (unsigned int i = 0; i < cases.size(); i++)
+                for (unsigned int j = 0; j < count; j++) {
+                    SweepCase c = cases[i];
+                    float v = (count == 1) ? from : from + (to - from) * j / (count - 1);
+                    if      (name == "speed")   c.speed = v;
+                    else if (name == "turn")    c.turn = v;
+                    else if (name == "gravity") c.gravity = v;
+                    else if (name == "delta")   c.delta = v;
+                    else throw Exception("Unknown sweep parameter: " + name);
+                    grown.push_back(c);
+                }
+            cases.swap(grown);
+        }
+        return cases;
+    }
+};
+
+#endif
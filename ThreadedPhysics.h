@@ -0,0 +1,317 @@
+#ifndef _THREADED_PHYSICS_
+#define _THREADED_PHYSICS_
+
+#include <Core/IListener.h>
+#include <Core/IModule.h>
+#include <Core/Thread.h>
+#include <Physics/FixedTimeStepPhysics.h>
+#include <Physics/RigidBox.h>
+#include <Scene/TransformationNode.h>
+#include <Math/Quaternion.h>
+#include <Math/Vector.h>
+#include <Utils/Timer.h>
+#include <Logging/Logger.h>
+
+#include "VehicleFleet.h"
+
+#include <vector>
+
+#if defined(_MSC_VER)
+#include <windows.h>
+#define MEMORY_BARRIER() MemoryBarrier()
+#define ATOMIC_EXCHANGE(ptr, value) InterlockedExchange((volatile LONG*)(ptr), (value))
+#else
+#define MEMORY_BARRIER() __sync_synchronize()
+#define ATOMIC_EXCHANGE(ptr, value) __sync_lock_test_and_set((ptr), (value))
+#endif
+
+using OpenEngine::Core::IListener;
+using OpenEngine::Core::IModule;
+using OpenEngine::Core::Thread;
+using OpenEngine::Core::InitializeEventArg;
+using OpenEngine::Core::ProcessEventArg;
+using OpenEngine::Core::DeinitializeEventArg;
+using OpenEngine::Physics::FixedTimeStepPhysics;
+using OpenEngine::Physics::RigidBox;
+using OpenEngine::Scene::TransformationNode;
+using OpenEngine::Math::Quaternion;
+using OpenEngine::Math::Vector;
+using OpenEngine::Utils::Timer;
+
+/**
+ * Lock free queue for exactly one producer and one consumer thread.
+ * Push fails when the queue is full.
+ */
+template <class T, unsigned int N>
+class SPSCQueue {
+private:
+    T items[N];
+    volatile unsigned int head; // next item to pop, owned by consumer
+    volatile unsigned int tail; // next free slot, owned by producer
+
+public:
+    SPSCQueue() : head(0), tail(0) {}
+
+    bool Push(const T& item) {
+        unsigned int next = (tail + 1) % N;
+        if (next == head) return false;
+        items[tail] = item;
+        MEMORY_BARRIER();
+        tail = next;
+        return true;
+    }
+
+    bool Pop(T& item) {
+        if (head == tail) return false;
+        MEMORY_BARRIER();
+        item = items[head];
+        MEMORY_BARRIER();
+        head = (head + 1) % N;
+        return true;
+    }
+};
+
+/**
+ * The state of all vehicles after one physics tick and the tick
+ * before it.
+ */
+struct PhysicsSnapshot {
+    unsigned int tick;
+    unsigned int time; // of the tick, in microseconds on the physics clock
+    std::vector< Vector<3,float> > position, previousPosition;
+    std::vector< Quaternion<float> > rotation, previousRotation;
+};
+
+/**
+ * Normalized linear interpolation of two rotations along the shorter
+ * arc. Close enough to slerp for the small angles between two ticks.
+ */
+inline Quaternion<float> NLerp(Quaternion<float> a, Quaternion<float> b, float t) {
+    Vector<3,float> av = a.GetImaginary(), bv = b.GetImaginary();
+    float aw = a.GetReal(), bw = b.GetReal();
+    if (aw * bw + av * bv < 0) {
+        bw = -bw;
+        bv = -bv;
+    }
+    Quaternion<float> q(aw + (bw - aw) * t, av + (bv - av) * t);
+    q.Normalize();
+    return q;
+}
+
+/**
+ * Three snapshots shared by one writer and one reader without locks.
+ *
+ * The writer fills its back buffer and swaps it with the middle one,
+ * the reader swaps its front buffer with the middle one when the
+ * middle holds a newer snapshot. Neither ever waits for the other.
+ */
+class SnapshotBuffer {
+private:
+    PhysicsSnapshot buffers[3];
+    volatile int middle; // index, ORed with FRESH when newly published
+    int back, front;
+    static const int FRESH = 4;
+
+public:
+    SnapshotBuffer() : middle(1), back(0), front(2) {}
+
+    PhysicsSnapshot& GetBack() { return buffers[back]; }
+
+    void Publish() {
+        MEMORY_BARRIER();
+        back = ATOMIC_EXCHANGE(&middle, back | FRESH) & 3;
+    }
+
+    // Returns true if a newer snapshot was acquired.
+    bool Acquire() {
+        if (!(middle & FRESH)) return false;
+        front = ATOMIC_EXCHANGE(&middle, front) & 3;
+        MEMORY_BARRIER();
+        return true;
+    }
+
+    const PhysicsSnapshot& GetFront() const { return buffers[front]; }
+};
+
+/**
+ * Runs FixedTimeStepPhysics on its own thread at a fixed tick rate.
+ *
+ * Control input arrives through a lock free queue and is applied by
+ * the fleet on the physics thread, together with any controllers such
+ * as AI drivers. After every tick the vehicle transformations are
+ * published into a triple buffer. On every engine process event the
+ * newest snapshot is copied into the vehicles' transformation nodes of
+ * the rendering scene, which the cameras follow. The rigid boxes must
+ * write to private transformation nodes, not to the rendered ones.
+ *
+ * With interpolation enabled the rendered transformations lag one
+ * tick behind and are interpolated between the last two ticks at the
+ * render time, so motion stays smooth at low tick rates. If the
+ * physics falls behind they are extrapolated by up to the given
+ * fraction of a tick.
+ */
+class ThreadedPhysics : public Thread,
+                        public IModule,
+                        public IVehicleControl {
+private:
+    struct Command {
+        unsigned int slot;
+        float up, down, left, right;
+    };
+
+    FixedTimeStepPhysics& physics;
+    VehicleFleet& fleet;
+    std::vector<TransformationNode*> bodyNodes;
+    std::vector<IListener<ProcessEventArg>*> controllers;
+    SPSCQueue<Command, 256> commands;
+    SnapshotBuffer snapshots;
+    std::vector< Vector<3,float> > previousPosition;
+    std::vector< Quaternion<float> > previousRotation;
+    unsigned int rate;
+    bool interpolate;
+    float maxExtrapolation;
+    volatile bool running;
+    unsigned int tick, scheduled;
+    Timer timer;
+
+    void Step() {
+        Command c;
+        while (commands.Pop(c))
+            fleet.SetControl(c.slot, c.up, c.down, c.left, c.right);
+
+        ProcessEventArg arg(OpenEngine::Utils::Time(), 0);
+        for (unsigned int i = 0; i < controllers.size(); i++)
+            controllers[i]->Handle(arg);
+        fleet.Apply(10.0f / rate);
+        physics.Handle(arg);
+        tick++;
+    }
+
+    void Capture(std::vector< Vector<3,float> >& position,
+                 std::vector< Quaternion<float> >& rotation) {
+        position.resize(bodyNodes.size());
+        rotation.resize(bodyNodes.size());
+        for (unsigned int i = 0; i < bodyNodes.size(); i++) {
+            position[i] = bodyNodes[i]->GetPosition();
+            rotation[i] = bodyNodes[i]->GetRotation();
+        }
+    }
+
+    void Publish() {
+        PhysicsSnapshot& s = snapshots.GetBack();
+        s.tick = tick;
+        s.time = (unsigned int)(scheduled * 1000000.0 / rate);
+        Capture(s.position, s.rotation);
+        s.previousPosition = previousPosition;
+        s.previousRotation = previousRotation;
+        snapshots.Publish();
+    }
+
+public:
+    static const unsigned int MIN_RATE = 4;
+
+    /**
+     * bodyNodes are the private nodes the rigid boxes of the fleet
+     * write to, in fleet order. The rate must be at least MIN_RATE.
+     */
+    ThreadedPhysics(FixedTimeStepPhysics& physics,
+                    VehicleFleet& fleet,
+                    std::vector<TransformationNode*> bodyNodes,
+                    unsigned int rate = 100)
+        : physics(physics)
+        , fleet(fleet)
+        , bodyNodes(bodyNodes)
+        , rate(rate)
+        , interpolate(true)
+        , maxExtrapolation(0.5f)
+        , running(false)
+        , tick(0)
+        , scheduled(0)
+    {}
+
+    void SetInterpolation(bool enable, float maxExtrapolation = 0.5f) {
+        interpolate = enable;
+        this->maxExtrapolation = maxExtrapolation;
+    }
+
+    void AddController(IListener<ProcessEventArg>* controller) {
+        controllers.push_back(controller);
+    }
+
+    void SetControl(unsigned int slot, float up, float down,
+                    float left, float right) {
+        Command c;
+        c.slot = slot;
+        c.up = up;
+        c.down = down;
+        c.left = left;
+        c.right = right;
+        if (!commands.Push(c))
+            logger.warning << "Physics command queue is full" << logger.end;
+    }
+
+    void Run() {
+        physics.Handle(InitializeEventArg());
+        while (running) {
+            double now = timer.GetElapsedTime().AsInt();
+            unsigned int due = (unsigned int)(now * rate / 1000000.0);
+            if (scheduled >= due) {
+                Thread::Sleep(1000000 / rate / 4);
+                continue;
+            }
+            // do not try to catch up more than a quarter second
+            if (due - scheduled > rate / 4) scheduled = due - rate / 4;
+            for (; scheduled < due; scheduled++) {
+                if (scheduled + 1 == due)
+                    Capture(previousPosition, previousRotation);
+                Step();
+            }
+            Publish();
+        }
+        physics.Handle(DeinitializeEventArg());
+    }
+
+    // The timer is started before the thread, so both threads only
+    // read it afterwards.
+    void Handle(InitializeEventArg arg) {
+        running = true;
+        timer.Start();
+        Start();
+    }
+
+    void Handle(ProcessEventArg arg) {
+        snapshots.Acquire();
+        const PhysicsSnapshot& s = snapshots.GetFront();
+
+        // Render one tick late: alpha 0 is the previous tick, 1 the
+        // newest one and above 1 is extrapolation.
+        float alpha = 1.0f;
+        if (interpolate) {
+            float tickTime = 1000000.0f / rate;
+            float now = timer.GetElapsedTime().AsInt();
+            alpha = (now - s.time) / tickTime;
+            if (alpha < 0.0f) alpha = 0.0f;
+            if (alpha > 1.0f + maxExtrapolation) alpha = 1.0f + maxExtrapolation;
+        }
+
+        for (unsigned int i = 0; i < s.position.size(); i++) {
+            TransformationNode* node = fleet.GetNode(i);
+            if (alpha == 1.0f || i >= s.previousPosition.size()) {
+                node->SetPosition(s.position[i]);
+                node->SetRotation(s.rotation[i]);
+            } else {
+                node->SetPosition(s.previousPosition[i] +
+                                  (s.position[i] - s.previousPosition[i]) * alpha);
+                node->SetRotation(NLerp(s.previousRotation[i], s.rotation[i], alpha));
+            }
+        }
+    }
+
+    void Handle(DeinitializeEventArg arg) {
+        running = false;
+        Wait();
+        logger.info << "Physics thread ran " << tick << " ticks" << logger.end;
+    }
+};
+
+#endif
@@ -0,0 +1,392 @@
+#ifndef _TRACK_PACK_
+#define _TRACK_PACK_
+
+#include <Core/Exceptions.h>
+#include <Resources/BinaryStreamArchive.h>
+#include <Resources/DirectoryManager.h>
+#include <Scene/ISceneNode.h>
+#include <Utils/Timer.h>
+#include <Logging/Logger.h>
+
+#include "ModelLoader.h"
+#include "SceneCache.h"
+#include "MappedFile.h"
+
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#if defined(_WIN32)
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#include <sys/types.h>
+#endif
+
+using OpenEngine::Core::Exception;
+using OpenEngine::Resources::BinaryStreamArchiveReader;
+using OpenEngine::Resources::DirectoryManager;
+using OpenEngine::Scene::ISceneNode;
+using OpenEngine::Utils::Timer;
+
+/**
+ * The kinds of entries in a track pack.
+ */
+enum PackKind {
+    PACK_MODEL,   // scene archive of a parsed model
+    PACK_TEXTURE, // texture file as is
+    PACK_PHYSICS  // scene archive of a built physics tree
+};
+
+struct PackEntry {
+    std::string   name;
+    PackKind      kind;
+    ModelSection  section; // of models
+    CacheHash     key;     // of physics trees, the tree parameters
+    unsigned long offset;  // of the data, from the start of the file
+    unsigned long size;
+    CacheHash     sum;
+};
+
+/**
+ * Whether a name can be stored in a pack and unpacked below a
+ * directory: relative and without parent references.
+ */
+inline bool IsPackName(const std::string& name) {
+    return !name.empty() && name[0] != '/' && name[0] != '\\' &&
+        name.find(':') == std::string::npos &&
+        name.find("..") == std::string::npos;
+}
+
+/**
+ * Writes a track pack.
+ *
+ * A pack starts with a table of contents holding a magic number, the
+ * format version and the name, kind, section, key, size and hash of
+ * every entry. The data of the entries follows in the same order. The
+ * file is written to a temporary name first and renamed into place,
+ * as the scene caches are.
+ */
+class TrackPackWriter {
+private:
+    std::vector<PackEntry> entries;
+    std::vector<std::string> data;
+
+    void Add(std::string name, PackKind kind, ModelSection section,
+             CacheHash key, const std::string& bytes) {
+        PackEntry e;
+        e.name = name;
+        e.kind = kind;
+        e.section = section;
+        e.key = key;
+        e.offset = 0;
+        e.size = bytes.size();
+        CacheKey sum;
+        sum.Add(bytes.data(), bytes.size());
+        e.sum = sum.Get();
+        entries.push_back(e);
+        data.push_back(bytes);
+    }
+
+    static void Write(std::ostream& os, CacheHash v) {
+        for (unsigned int i = 0; i < 8; i++)
+            os.put((char)((v >> (8*i)) & 0xFF));
+    }
+
+public:
+    static const unsigned int VERSION = 1;
+
+    void AddModel(std::string name, ModelSection section, ISceneNode* node) {
+        Add(name, PACK_MODEL, section, 0, SceneCache::Serialize(name, node));
+    }
+
+    /**
+     * Add a file found in the data path. Returns false if it is
+     * missing or its name is not a pack name.
+     */
+    bool AddTexture(std::string name) {
+        if (!IsPackName(name)) return false;
+        std::ifstream in(DirectoryManager::FindFileInPath(name).c_str(),
+                         std::ios::binary);
+        if (!in.good()) return false;
+        std::ostringstream bytes(std::ios::out | std::ios::binary);
+        bytes << in.rdbuf();
+        Add(name, PACK_TEXTURE, SECTION_NONE, 0, bytes.str());
+        return true;
+    }
+
+    void AddPhysics(CacheHash key, ISceneNode* tree) {
+        Add("physics", PACK_PHYSICS, SECTION_NONE, key,
+            SceneCache::Serialize("physics", tree));
+    }
+
+    unsigned int GetCount() const { return entries.size(); }
+
+    bool Save(std::string path) {
+        std::ostringstream tmp;
+        tmp << path << ".tmp" << getpid();
+        std::ofstream of(tmp.str().c_str(), std::ios::binary | std::ios::trunc);
+        of.write("OETP", 4);
+        Write(of, VERSION);
+        Write(of, entries.size());
+        for (unsigned int i = 0; i < entries.size(); i++) {
+            Write(of, entries[i].name.size());
+            of.write(entries[i].name.data(), entries[i].name.size());
+            Write(of, entries[i].kind);
+            Write(of, entries[i].section);
+            Write(of, entries[i].key);
+            Write(of, entries[i].size);
+            Write(of, entries[i].sum);
+        }
+        for (unsigned int i = 0; i < data.size(); i++)
+            of.write(data[i].data(), data[i].size());
+        of.close();
+        if (!of.good()) {
+            remove(tmp.str().c_str());
+            return false;
+        }
+#if defined(_WIN32)
+        remove(path.c_str());
+#endif
+        if (rename(tmp.str().c_str(), path.c_str()) != 0) {
+            remove(tmp.str().c_str());
+            return false;
+        }
+        return true;
+    }
+};
+
+/**
+ * A track read from a pack written by TrackPackWriter, in place of
+ * models.txt and the model files it lists.
+ *
+ * The pack is memory mapped with sequential read ahead and every
+ * entry is checked against its hash when the pack is opened, so a
+ * damaged pack is rejected before anything is built from it. The
+ * textures are written once to a directory of the cache, named by the
+ * hash of the pack, which is put first in the data path. The models
+ * then find their textures by the same names as when they were packed,
+ * and copies in the data directories do not override them.
+ */
+class TrackPack {
+private:
+    std::string path;
+    MappedFile* file;
+    std::vector<PackEntry> entries;
+    CacheHash hash; // of the table of contents, covering every entry
+
+    TrackPack(const TrackPack&);
+    TrackPack& operator=(const TrackPack&);
+
+    static CacheHash Read(std::istream& is) {
+        CacheHash v = 0;
+        for (unsigned int i = 0; i < 8; i++)
+            v |= ((CacheHash)(unsigned char)is.get()) << (8*i);
+        return v;
+    }
+
+    // Create every directory of a file path.
+    static void MakeDirectories(std::string file) {
+        std::string::size_type pos = file.find_first_of("/\\", 1);
+        for (; pos != std::string::npos; pos = file.find_first_of("/\\", pos + 1)) {
+            std::string dir = file.substr(0, pos);
+#if defined(_WIN32)
+            _mkdir(dir.c_str());
+#else
+            mkdir(dir.c_str(), 0755);
+#endif
+        }
+    }
+
+    void Invalid(std::string reason) {
+        delete file;
+        file = NULL;
+        throw Exception("Invalid track pack " + path + ": " + reason);
+    }
+
+    void ExtractTextures(std::string cacheDir) {
+        std::string dir = (cacheDir.empty() ? std::string(".") : cacheDir)
+            + "/oeracer-pack-" + CacheKey::ToString(hash) + "/";
+        unsigned int written = 0;
+        for (unsigned int i = 0; i < entries.size(); i++) {
+            const PackEntry& e = entries[i];
+            if (e.kind != PACK_TEXTURE) continue;
+            if (!IsPackName(e.name)) Invalid("bad texture name " + e.name);
+            std::string name = dir + e.name;
+            std::ifstream in(name.c_str(), std::ios::binary | std::ios::ate);
+            if (in.good() && (unsigned long)in.tellg() == e.size) continue;
+            in.close();
+
+            MakeDirectories(name);
+            std::ofstream of(name.c_str(), std::ios::binary | std::ios::trunc);
+            of.write(file->GetData() + e.offset, e.size);
+            of.close();
+            if (!of.good())
+                throw Exception("Could not unpack texture: " + name);
+            written++;
+        }
+        if (written > 0)
+            logger.info << "Unpacked " << written << " textures to " << dir
+                        << logger.end;
+        DirectoryManager::PrependPath(dir);
+    }
+
+public:
+    /**
+     * Open and check a pack. Throws if it is missing or damaged.
+     */
+    TrackPack(std::string path, std::string cacheDir)
+        : path(path)
+        , file(new MappedFile(path))
+    {
+        Timer timer;
+        timer.Start();
+        if (!file->IsOpen()) Invalid("can not open the file");
+
+        MemoryInputStream is(file->GetData(), file->GetSize());
+        char magic[4];
+        is.read(magic, 4);
+        if (!is.good() || std::string(magic, 4) != "OETP")
+            Invalid("not a track pack");
+        if (Read(is) != TrackPackWriter::VERSION)
+            Invalid("unsupported version");
+
+        CacheKey toc;
+        CacheHash count = Read(is);
+        unsigned long offset = 4 + 8 + 8;
+        for (CacheHash i = 0; i < count && is.good(); i++) {
+            PackEntry e;
+            CacheHash length = Read(is);
+            if (length > file->GetSize()) Invalid("truncated table of contents");
+            e.name.resize(length);
+            if (length > 0) is.read(&e.name[0], length);
+            e.kind    = (PackKind)Read(is);
+            e.section = (ModelSection)Read(is);
+            e.key     = Read(is);
+            e.size    = Read(is);
+            e.sum     = Read(is);
+            e.offset  = 0;
+            offset += 8 + length + 5*8;
+            toc.Add(e.name);
+            toc.Add((unsigned int)e.kind);
+            toc.Add((unsigned int)e.section);
+            toc.Add((const char*)&e.key, sizeof(e.key));
+            toc.Add((const char*)&e.sum, sizeof(e.sum));
+            entries.push_back(e);
+        }
+        if (!is.good() || entries.size() != count)
+            Invalid("truncated table of contents");
+        hash = toc.Get();
+
+        // the data follows the table of contents in entry order
+        for (unsigned int i = 0; i < entries.size(); i++) {
+            PackEntry& e = entries[i];
+            if (e.size > file->GetSize() - offset) Invalid("truncated data");
+            e.offset = offset;
+            CacheKey sum;
+            sum.Add(file->GetData() + e.offset, e.size);
+            if (sum.Get() != e.sum) Invalid("corrupt entry " + e.name);
+            offset += e.size;
+        }
+
+        ExtractTextures(cacheDir);
+        logger.info << "Opened the track pack " << path << " ("
+                    << file->GetSize() / 1024 << " KB, " << entries.size()
+                    << " entries) in " << timer.GetElapsedTime().AsInt() / 1000
+                    << " ms" << logger.end;
+    }
+
+    ~TrackPack() {
+        delete file;
+    }
+
+    /**
+     * The key of a physics tree built with the given parameters.
+     */
+    static CacheHash PhysicsKey(unsigned int maxFaceCount, unsigned int maxQuadSize) {
+        CacheKey key;
+        key.Add(std::string("packed physics tree 1"));
+        key.Add(maxFaceCount);
+        key.Add(maxQuadSize);
+        return key.Get();
+    }
+
+    /**
+     * Add the contents of the pack to a cache key, in place of the
+     * model files it was packed from.
+     */
+    void AddTo(CacheKey& key) const {
+        key.Add((const char*)&hash, sizeof(hash));
+    }
+
+    /**
+     * The model list of the pack, in the order of models.txt.
+     */
+    std::vector<ModelEntry> GetModels() const {
+        std::vector<ModelEntry> models;
+        for (unsigned int i = 0; i < entries.size(); i++)
+            if (entries[i].kind == PACK_MODEL)
+                models.push_back(ModelEntry(entries[i].name, entries[i].section));
+        return models;
+    }
+
+    /**
+     * Read the scenes of the models that are not skipped, in the
+     * order they are stored.
+     */
+    void Load(std::vector<ModelEntry>& models) {
+        std::map<std::string, unsigned int> index;
+        for (unsigned int i = 0; i < entries.size(); i++)
+            if (entries[i].kind == PACK_MODEL)
+                index[entries[i].name] = i;
+
+        Timer total;
+        total.Start();
+        unsigned int loaded = 0;
+        for (unsigned int i = 0; i < models.size(); i++) {
+            ModelEntry& entry = models[i];
+            std::map<std::string, unsigned int>::iterator itr = index.find(entry.file);
+            if (entry.skip || itr == index.end()) continue;
+            const PackEntry& e = entries[itr->second];
+            unsigned long allocations = GetThreadAllocationCount();
+            Timer timer;
+            timer.Start();
+            MemoryInputStream is(file->GetData() + e.offset, e.size);
+            BinaryStreamArchiveReader reader(is);
+            entry.node = reader.ReadScene(e.name);
+            entry.loadTime = timer.GetElapsedTime().AsInt();
+            entry.allocations = GetThreadAllocationCount() - allocations;
+            loaded++;
+        }
+        logger.info << "Read " << loaded << " models from the track pack in "
+                    << total.GetElapsedTime().AsInt() / 1000 << " ms"
+                    << logger.end;
+    }
+
+    bool HasPhysics(CacheHash key) const {
+        for (unsigned int i = 0; i < entries.size(); i++)
+            if (entries[i].kind == PACK_PHYSICS && entries[i].key == key)
+                return true;
+        return false;
+    }
+
+    /**
+     * The physics tree built with the given key, or NULL if the pack
+     * holds none.
+     */
+    ISceneNode* LoadPhysics(CacheHash key) {
+        for (unsigned int i = 0; i < entries.size(); i++) {
+            const PackEntry& e = entries[i];
+            if (e.kind != PACK_PHYSICS || e.key != key) continue;
+            MemoryInputStream is(file->GetData() + e.offset, e.size);
+            BinaryStreamArchiveReader reader(is);
+            return reader.ReadScene("physics");
+        }
+        return NULL;
+    }
+};
+
+#endif
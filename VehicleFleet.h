@@ -0,0 +1,183 @@
+#ifndef _VEHICLE_FLEET_
+#define _VEHICLE_FLEET_
+
+#include <Core/IModule.h>
+#include <Physics/RigidBox.h>
+#include <Scene/TransformationNode.h>
+#include <Math/Matrix.h>
+#include <Math/Vector.h>
+#include <Utils/Timer.h>
+
+#include <vector>
+
+using OpenEngine::Core::IModule;
+using OpenEngine::Core::InitializeEventArg;
+using OpenEngine::Core::ProcessEventArg;
+using OpenEngine::Core::DeinitializeEventArg;
+using OpenEngine::Physics::RigidBox;
+using OpenEngine::Scene::TransformationNode;
+using OpenEngine::Math::Matrix;
+using OpenEngine::Math::Vector;
+using OpenEngine::Utils::Timer;
+
+/**
+ * Receives the control inputs of vehicles, identified by their slot
+ * in the fleet.
+ */
+class IVehicleControl {
+public:
+    virtual ~IVehicleControl() {}
+    virtual void SetControl(unsigned int slot, float up, float down,
+                            float left, float right) = 0;
+};
+
+/**
+ * The vehicles of a race and their control inputs.
+ *
+ * Controllers (keyboard handlers, input logs, AI drivers) write the
+ * throttle, brake and steering of their vehicle into packed arrays.
+ * Once per tick Apply computes the control forces of all vehicles in
+ * one pass over those arrays and hands them to the rigid boxes.
+ *
+ * Thrust acts on the front corners 1-4 of a box, braking on the rear
+ * corners 5-8 and steering on two of the front corners. Forces on the
+ * same corner are summed, so a vehicle gets at most eight AddForce
+ * calls per tick.
+ */
+class VehicleFleet : public IModule, public IVehicleControl {
+private:
+    std::vector<RigidBox*> boxes;
+    std::vector<TransformationNode*> nodes;
+
+    // control inputs in [0,1]
+    std::vector<float> up, down, left, right;
+
+    // per tick scratch: box axes and corner forces
+    std::vector<float> fx, fy, fz, sx, sy, sz;
+    std::vector<float> ax, ay, az, bx, by, bz, cx, cy, cz;
+
+    float speed, turn;
+    float fixedDelta;
+    Timer timer;
+
+    void Resize(std::vector<float>& v) { v.resize(boxes.size(), 0.0f); }
+
+public:
+    VehicleFleet()
+        : speed(1750.0f)
+        , turn(550.0f)
+        , fixedDelta(0.0f)
+    {}
+
+    /**
+     * Add a vehicle. The node is the transformation of the vehicle in
+     * the rendering scene.
+     */
+    unsigned int Add(RigidBox* box, TransformationNode* node) {
+        boxes.push_back(box);
+        nodes.push_back(node);
+        std::vector<float>* arrays[] = {
+            &up, &down, &left, &right,
+            &fx, &fy, &fz, &sx, &sy, &sz,
+            &ax, &ay, &az, &bx, &by, &bz, &cx, &cy, &cz };
+        for (unsigned int i = 0; i < sizeof(arrays)/sizeof(arrays[0]); i++)
+            Resize(*arrays[i]);
+        return boxes.size() - 1;
+    }
+
+    unsigned int GetSize() const { return boxes.size(); }
+    RigidBox* GetBox(unsigned int i) { return boxes[i]; }
+    TransformationNode* GetNode(unsigned int i) { return nodes[i]; }
+
+    void SetControl(unsigned int i, float up, float down, float left, float right) {
+        this->up[i] = up;
+        this->down[i] = down;
+        this->left[i] = left;
+        this->right[i] = right;
+    }
+
+    void SetSpeed(float speed) { this->speed = speed; }
+    void SetTurn(float turn) { this->turn = turn; }
+    float GetSpeed() const { return speed; }
+    float GetTurn() const { return turn; }
+
+    /**
+     * Scale the control forces by a constant delta instead of the
+     * wall clock time between process events. A delta of zero
+     * re-enables the wall clock.
+     */
+    void SetFixedDelta(float delta) { fixedDelta = delta; }
+
+    void Handle(InitializeEventArg arg) {
+        timer.Start();
+    }
+    void Handle(DeinitializeEventArg arg) {}
+
+    void Handle(ProcessEventArg arg) {
+        float delta = (float) timer.GetElapsedTimeAndReset().AsInt() / 100000;
+        if (fixedDelta > 0.0f) delta = fixedDelta;
+        Apply(delta);
+    }
+
+    void Apply(float delta) {
+        const unsigned int n = boxes.size();
+
+        // gather the forward and side axes of every box
+        for (unsigned int i = 0; i < n; i++) {
+            if (boxes[i] == NULL || !(up[i] || down[i] || left[i] || right[i])) {
+                fx[i] = fy[i] = fz[i] = sx[i] = sy[i] = sz[i] = 0.0f;
+                continue;
+            }
+            Matrix<3,3,float> m(boxes[i]->GetRotationMatrix());
+            Vector<3,float> f = m.GetRow(0);
+            Vector<3,float> s = m.GetRow(2);
+            fx[i] = f[0]; fy[i] = f[1]; fz[i] = f[2];
+            sx[i] = s[0]; sy[i] = s[1]; sz[i] = s[2];
+        }
+
+        // corner forces: a = corners 1 and 3, b = corners 2 and 4,
+        // c = corners 5 to 8
+        const float sp = speed * delta;
+        const float tu = turn * delta;
+        for (unsigned int i = 0; i < n; i++) {
+            float t = sp * up[i];
+            float r = tu * right[i];
+            float l = tu * left[i];
+            float b = sp * down[i];
+            ax[i] = fx[i] * t + sx[i] * r;
+            ay[i] = fy[i] * t + sy[i] * r;
+            az[i] = fz[i] * t + sz[i] * r;
+            bx[i] = fx[i] * t - sx[i] * l;
+            by[i] = fy[i] * t - sy[i] * l;
+            bz[i] = fz[i] * t - sz[i] * l;
+            cx[i] = -fx[i] * b;
+            cy[i] = -fy[i] * b;
+            cz[i] = -fz[i] * b;
+        }
+
+        // scatter the forces to the boxes
+        for (unsigned int i = 0; i < n; i++) {
+            RigidBox* box = boxes[i];
+            if (box == NULL) continue;
+            if (up[i] || right[i]) {
+                Vector<3,float> a(ax[i], ay[i], az[i]);
+                box->AddForce(a, 1);
+                box->AddForce(a, 3);
+            }
+            if (up[i] || left[i]) {
+                Vector<3,float> b(bx[i], by[i], bz[i]);
+                box->AddForce(b, 2);
+                box->AddForce(b, 4);
+            }
+            if (down[i]) {
+                Vector<3,float> c(cx[i], cy[i], cz[i]);
+                box->AddForce(c, 5);
+                box->AddForce(c, 6);
+                box->AddForce(c, 7);
+                box->AddForce(c, 8);
+            }
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,80 @@
+#ifndef _VIEWS_
+#define _VIEWS_
+
+#include <Display/IViewingVolume.h>
+#include <Display/ICanvasBackend.h>
+#include <Resources/ITexture2D.h>
+#include <Math/Matrix.h>
+
+using OpenEngine::Display::IViewingVolume;
+using OpenEngine::Display::ICanvasBackend;
+using OpenEngine::Resources::ITexture2DPtr;
+using OpenEngine::Math::Matrix;
+
+/**
+ * Told which view is being rendered, for per view work in the scene
+ * such as culling and level of detail selection.
+ */
+class IViewListener {
+public:
+    virtual ~IViewListener() {}
+    virtual void BeginView(unsigned int view) = 0;
+    virtual void EndView() = 0;
+};
+
+/**
+ * Wraps the backend of a canvas and tells a view listener when the
+ * canvas starts and ends rendering its view.
+ */
+class ViewBackend : public ICanvasBackend {
+private:
+    ICanvasBackend* backend;
+    IViewListener& listener;
+    unsigned int view;
+
+public:
+    ViewBackend(ICanvasBackend* backend, IViewListener& listener, unsigned int view)
+        : backend(backend), listener(listener), view(view) {}
+
+    virtual ~ViewBackend() { delete backend; }
+
+    void Create(unsigned int width, unsigned int height) { backend->Create(width, height); }
+    void Init(unsigned int width, unsigned int height) { backend->Init(width, height); }
+    void Deinit() { backend->Deinit(); }
+    void Resize(unsigned int width, unsigned int height) { backend->Resize(width, height); }
+    ITexture2DPtr GetTexture() { return backend->GetTexture(); }
+
+    ICanvasBackend* Clone() {
+        return new ViewBackend(backend->Clone(), listener, view);
+    }
+
+    void Pre() {
+        backend->Pre();
+        listener.BeginView(view);
+    }
+
+    void Post() {
+        listener.EndView();
+        backend->Post();
+    }
+};
+
+/**
+ * The six planes (a,b,c,d) of a view frustum, with a*x+b*y+c*z+d >= 0
+ * inside. OpenEngine matrices transform row vectors, so the planes are
+ * combinations of the columns of view * projection.
+ */
+inline void GetFrustumPlanes(IViewingVolume& view, float planes[6][4]) {
+    Matrix<4,4,float> m = view.GetViewMatrix() * view.GetProjectionMatrix();
+    for (unsigned int i = 0; i < 4; i++) {
+        float c0 = m(i,0), c1 = m(i,1), c2 = m(i,2), c3 = m(i,3);
+        planes[0][i] = c3 + c0; // left
+        planes[1][i] = c3 - c0; // right
+        planes[2][i] = c3 + c1; // bottom
+        planes[3][i] = c3 - c1; // top
+        planes[4][i] = c3 + c2; // near
+        planes[5][i] = c3 - c2; // far
+    }
+}
+
+#endif
@@ -0,0 +1,111 @@
+#ifndef _WORKER_POOL_
+#define _WORKER_POOL_
+
+#include <Core/Thread.h>
+#include <Core/Mutex.h>
+
+#include <vector>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+using OpenEngine::Core::Thread;
+using OpenEngine::Core::Mutex;
+
+/**
+ * A job for the worker pool. Execute is called once for every index
+ * in [0, count) from one of the pool threads.
+ */
+class IWorkerJob {
+public:
+    virtual ~IWorkerJob() {}
+    virtual void Execute(unsigned int index) = 0;
+};
+
+/**
+ * A small fixed size thread pool.
+ *
+ * Run blocks until all indices of the job have been executed. The
+ * order in which indices finish is unspecified, so jobs must write
+ * their results into per index slots.
+ *
+ * The threads take the indices in increasing order from one shared
+ * counter, so a job with its costliest indices first is scheduled
+ * longest first.
+ */
+class WorkerPool {
+private:
+    class Worker : public Thread {
+    public:
+        WorkerPool& pool;
+        Worker(WorkerPool& pool) : pool(pool) {}
+        void Run() { pool.Work(); }
+    };
+
+    unsigned int threads;
+    IWorkerJob* job;
+    unsigned int next, count;
+    Mutex lock;
+
+    bool Fetch(unsigned int& index) {
+        lock.Lock();
+        bool found = next < count;
+        if (found) index = next++;
+        lock.Unlock();
+        return found;
+    }
+
+    void Work() {
+        unsigned int index;
+        while (Fetch(index))
+            job->Execute(index);
+    }
+
+public:
+    WorkerPool(unsigned int threads = 0)
+        : threads(threads == 0 ? HardwareThreads() : threads)
+        , job(NULL)
+        , next(0)
+        , count(0)
+    {}
+
+    unsigned int GetThreadCount() const { return threads; }
+
+    void Run(IWorkerJob& job, unsigned int count) {
+        this->job = &job;
+        this->next = 0;
+        this->count = count;
+
+        // the calling thread works too, so one thread means serial
+        std::vector<Worker*> workers;
+        for (unsigned int i = 1; i < threads && i < count; i++) {
+            Worker* w = new Worker(*this);
+            w->Start();
+            workers.push_back(w);
+        }
+        Work();
+        for (unsigned int i = 0; i < workers.size(); i++) {
+            workers[i]->Wait();
+            delete workers[i];
+        }
+        this->job = NULL;
+    }
+
+    static unsigned int HardwareThreads() {
+#if defined(_WIN32)
+        SYSTEM_INFO info;
+        GetSystemInfo(&info);
+        return info.dwNumberOfProcessors;
+#elif defined(_SC_NPROCESSORS_ONLN)
+        long n = sysconf(_SC_NPROCESSORS_ONLN);
+        return n > 0 ? n : 1;
+#else
+        return 1;
+#endif
+    }
+};
+
+#endif
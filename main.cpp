@@ -56,9 +56,35 @@
 // Serialization utilities
 #include <Resources/BinaryStreamArchive.h>
 #include <fstream>
+#include <cstdlib>
+#include <cctype>
+#include <cfloat>
+#include <set>
 
 // OERacer utility files
 #include "KeyboardHandler.h"
+#include "HeadlessSimulation.h"
+#include "InputLog.h"
+#include "ModelLoader.h"
+#include "SceneCache.h"
+#include "SceneGeometry.h"
+#include "Profiler.h"
+#include "StartupReport.h"
+#include "VehicleFleet.h"
+#include "AIDriver.h"
+#include "ThreadedPhysics.h"
+#include "Culling.h"
+#include "RenderList.h"
+#include "MeshOptimizer.h"
+#include "LevelOfDetail.h"
+#include "Streaming.h"
+#include "PhysicsTree.h"
+#include "CollisionBVH.h"
+#include "Sweep.h"
+#include "PartitionTuner.h"
+#include "FaceArena.h"
+#include "Composition.h"
+#include "TrackPack.h"
 
 // Additional namespaces
 using namespace OpenEngine::Core;
@@ -86,8 +112,66 @@ struct Config {
     ISceneNode*           staticScene;
     ISceneNode*           physicScene;
     RigidBox*             physicBody;
+    VehicleFleet          fleet;
+    AIDriver*             ai;
+    unsigned int          aiVehicles;
+    bool                  physicsThread;
+    unsigned int          physicsRate;
+    bool                  interpolate;
+    vector<TransformationNode*> bodyNodes;
+    ThreadedPhysics*      threadedPhysics;
+    HeadlessSimulation*   simulation; // stepped in real time
     FixedTimeStepPhysics* physics;
     bool                  serialize;
+    bool                  headless;
+    unsigned int          headlessTicks;
+    string                recordFile;
+    string                replayFile;
+    float                 inputDelta;
+    unsigned int          loadThreads;
+    vector<ModelEntry>    models;
+    string                cacheDir;
+    unsigned int          physicsMaxFaceCount; // 0: transformer default
+    unsigned int          physicsMaxQuadSize;  // 0: transformer default
+    unsigned int          renderMaxFaceCount;
+    unsigned int          renderMaxQuadSize;
+    Profiler*             profiler;
+    string                profileFile;
+    StartupReport         report;
+    string                reportFile;
+    bool                  culling;
+    CullingPass*          cullingPass;
+    bool                  renderList;
+    bool                  batching;
+    bool                  meshOptimization;
+    bool                  meshBenchmark;
+    string                meshBenchmarkFile;
+    unsigned int          lodLevels;   // 1: no level of detail
+    float                 lodCellSize; // of the first coarser level
+    LODSelector*          lodSelector;
+    float                 tileSize;   // 0: no streaming
+    unsigned int          tileBudget; // MB
+    vector<TileInfo>      tiles;
+    CacheHash             staticKey; // computed once the models are known
+    CacheHash             tilesKey;
+    RenderListNode*       renderListNode;
+    bool                  buildBenchmark;
+    string                collisionBenchmark; // "bvh", "quadbsp" or "both"
+    float                 gravity;      // of the vehicles
+    Vector<3,float>       start;        // of the player's vehicle
+    float                 circuitSize;  // radius of the AI circuit around start
+    unsigned int          circuitPoints;
+    ISceneNode*           vehicleModel; // of the player's vehicle
+    string                sweepGrid;
+    string                sweepFile;
+    bool                  tunePartition;
+    bool                  arena;
+    bool                  directComposition;
+    unsigned int          benchmarkFrames; // 0: run until stopped
+    string                tuneFile;
+    string                packFile;  // written by --pack
+    string                trackPack; // read in place of models.txt
+    TrackPack*            pack;
     Config()
         : setup(SimpleSetup("<<OpenEngine Racer>>"))
                             //, new Viewport(0,0,400,300)))
@@ -96,18 +180,67 @@ struct Config {
                             // , new Engine()
                             // , new Renderer())
         , camera(NULL)
+        , cam_br(NULL)
+        , cam_tr(NULL)
+        , cam_tl(NULL)
         , renderingScene(NULL)
         , dynamicScene(NULL)
         , staticScene(NULL)
         , physicScene(NULL)
+        , physicBody(NULL)
+        , ai(NULL)
+        , aiVehicles(0)
+        , physicsThread(false)
+        , physicsRate(100)
+        , interpolate(true)
+        , threadedPhysics(NULL)
+        , simulation(NULL)
         , physics(NULL)
         , serialize(true)
+        , headless(false)
+        , headlessTicks(10000)
+        , inputDelta(0.1f)
+        , loadThreads(0)
+        , cacheDir(".")
+        , physicsMaxFaceCount(0)
+        , physicsMaxQuadSize(0)
+        , renderMaxFaceCount(500)
+        , renderMaxQuadSize(100)
+        , profiler(NULL)
+        , culling(true)
+        , cullingPass(NULL)
+        , renderList(true)
+        , batching(true)
+        , meshOptimization(false)
+        , meshBenchmark(false)
+        , lodLevels(3)
+        , lodCellSize(2.0f)
+        , lodSelector(NULL)
+        , tileSize(0.0f)
+        , tileBudget(64)
+        , staticKey(0)
+        , tilesKey(0)
+        , renderListNode(NULL)
+        , buildBenchmark(false)
+        , gravity(9.82f*20)
+        , start(2, 100, 2)
+        , circuitSize(300)
+        , circuitPoints(8)
+        , vehicleModel(NULL)
+        , sweepFile("sweep.csv")
+        , tunePartition(false)
+        , arena(true)
+        , directComposition(false)
+        , benchmarkFrames(0)
+        , tuneFile("partition.csv")
+        , pack(NULL)
     {
         
     }
 };
 
 // Forward declaration of the setup methods
+void ParseArguments(Config&, int argc, char** argv);
 void SetupResources(Config&);
 void SetupDisplay(Config&);
 void SetupScene(Config&);
@@ -115,10 +248,32 @@ void SetupPhysics(Config&);
 void SetupRendering(Config&);
 void SetupDevices(Config&);
 void SetupDebugging(Config&);
+void RunHeadless(Config&);
+void RunMeshBenchmark(Config&);
+void RunBuildBenchmark(Config&);
+void RunCollisionBenchmark(Config&);
+void RunSweep(Config&);
+void RunPartitionTuner(Config&);
+void RunPack(Config&);
+void AttachHeadlessInput(Config&, HeadlessSimulation&, KeyboardHandler*&, InputPlayer*&);
+void BuildPhysicsTree(Config&);
+void PartitionPhysicsScene(ISceneNode&, unsigned int, unsigned int);
+void PartitionStaticScene(Config&);
+void LogSceneMemory(Config&);
+IListener<OpenEngine::Core::ProcessEventArg>&
+    Profiled(Config&, IListener<OpenEngine::Core::ProcessEventArg>&, string);
+ICanvasBackend* CanvasBackend(Config&, string, IViewingVolume* view = NULL,
+                              ICanvasBackend* base = NULL);
+void RunPhase(Config&, string, void (*)(Config&));
+RigidBox* CreateVehicle(Config&, ISceneNode*, TransformationNode*, Vector<3,float>);
+CacheHash StaticSceneKey(Config&);
+CacheHash TilesKey(Config&);
+void AddModelFiles(CacheKey&, string);
 
 int main(int argc, char** argv) {
 
     Config config;
+    ParseArguments(config, argc, argv);
 
     // Print usage info.
     logger.info << "========= Running The OpenEngine Racer Project =========" << logger.end;
@@ -138,14 +293,108 @@ int main(int argc, char** argv) {
     logger.info << "  move right:      d" << logger.end;
     logger.info << "  rotate:          mouse" << logger.end;
     logger.info << logger.end;
+    logger.info << "Command line options:" << logger.end;
+    logger.info << "  --headless [ticks]  run the physics without a display" << logger.end;
+    logger.info << "  --record <file>     record the vehicle input to a log" << logger.end;
+    logger.info << "  --replay <file>     drive the vehicle from an input log" << logger.end;
+    logger.info << "  --load-threads <n>  threads used to load models (0: all cores)" << logger.end;
+    logger.info << "  --cache-dir <dir>   directory of the scene caches" << logger.end;
+    logger.info << "  --no-cache          always rebuild the physics tree and static scene" << logger.end;
+    logger.info << "  --profile <file>    write stage timings as Chrome trace (.json) or .csv" << logger.end;
+    logger.info << "  --startup-report <file>  write startup timings as JSON" << logger.end;
+    logger.info << "  --vehicles <n>      add n AI driven copies of the vehicle" << logger.end;
+    logger.info << "  --physics-thread [hz]  run the physics on its own thread" << logger.end;
+    logger.info << "  --no-interpolation  show the physics thread state as is" << logger.end;
+    logger.info << "  --no-culling        draw the whole static scene in every view" << logger.end;
+    logger.info << "  --no-render-list    render by traversing the scene graph" << logger.end;
+    logger.info << "  --no-batching       keep the static geometry of each model separate" << logger.end;
+    logger.info << "  --mesh-opt          reorder triangles for an indexed vertex cache" << logger.end;
+    logger.info << "  --no-arena          keep every physics face in its own allocation" << logger.end;
+    logger.info << "  --direct-composition  copy the views straight into one frame texture" << logger.end;
+    logger.info << "  --frame-benchmark <n>  time n frames and quit" << logger.end;
+    logger.info << "  --mesh-benchmark [file.csv]  report mesh memory and ACMR per model" << logger.end;
+    logger.info << "  --lod-levels <n>    levels of detail of the static scene (1: off)" << logger.end;
+    logger.info << "  --lod-cell <size>   simplification grid of the first coarser level" << logger.end;
+    logger.info << "  --stream-tiles <size>  stream the static scene in tiles of this size" << logger.end;
+    logger.info << "  --tile-budget <MB>  memory budget of the streamed tiles" << logger.end;
+    logger.info << "  --build-benchmark   time the physics tree build per thread count" << logger.end;
+    logger.info << "  --collision-benchmark [bvh|quadbsp]  time collision queries along a drive" << logger.end;
+    logger.info << "  --sweep <grid> [file.csv]  run headless worlds over a parameter grid" << logger.end;
+    logger.info << "  --tune-partition [file.csv]  measure quad tree settings of the track" << logger.end;
+    logger.info << "  --pack <file>       pack the track, with its physics tree unless --no-cache" << logger.end;
+    logger.info << "  --track-pack <file>  load the track from a pack instead of models.txt" << logger.end;
+    logger.info << logger.end;
+
+    // Measure the models only
+    if (config.meshBenchmark) {
+        RunPhase(config, "SetupResources", SetupResources);
+        RunMeshBenchmark(config);
+        return EXIT_SUCCESS;
+    }
+
+    // Pack the track into one file
+    if (!config.packFile.empty()) {
+        RunPhase(config, "SetupResources", SetupResources);
+        RunPack(config);
+        return EXIT_SUCCESS;
+    }
+
+    // Measure the partition settings on the raw models
+    if (config.tunePartition) {
+        RunPhase(config, "SetupResources", SetupResources);
+        RunPartitionTuner(config);
+        return EXIT_SUCCESS;
+    }
+
+    // Build the physics tree only
+    if (config.buildBenchmark) {
+        RunPhase(config, "SetupResources", SetupResources);
+        RunPhase(config, "SetupScene",     SetupScene);
+        RunBuildBenchmark(config);
+        return EXIT_SUCCESS;
+    }
+
+    // Compare the collision structures along a drive
+    if (!config.collisionBenchmark.empty()) {
+        RunPhase(config, "SetupResources", SetupResources);
+        RunPhase(config, "SetupScene",     SetupScene);
+        RunCollisionBenchmark(config);
+        return EXIT_SUCCESS;
+    }
+
+    // Run many headless worlds in parallel
+    if (!config.sweepGrid.empty()) {
+        RunPhase(config, "SetupResources", SetupResources);
+        RunPhase(config, "SetupScene",     SetupScene);
+        RunPhase(config, "SetupPhysics",   SetupPhysics);
+        RunSweep(config);
+        return EXIT_SUCCESS;
+    }
+
+    // Run the physics only, without display and rendering
+    if (config.headless) {
+        RunPhase(config, "SetupResources", SetupResources);
+        RunPhase(config, "SetupScene",     SetupScene);
+        RunPhase(config, "SetupPhysics",   SetupPhysics);
+        if (!config.reportFile.empty())
+            config.report.Write(config.reportFile);
+        RunHeadless(config);
+        return EXIT_SUCCESS;
+    }
 
     // Setup the engine
-    SetupResources(config);
-    SetupDisplay(config);
-    SetupScene(config);
-    SetupPhysics(config);
-    SetupRendering(config);
-    SetupDevices(config);
+    RunPhase(config, "SetupResources", SetupResources);
+    RunPhase(config, "SetupDisplay",   SetupDisplay);
+    RunPhase(config, "SetupScene",     SetupScene);
+    RunPhase(config, "SetupPhysics",   SetupPhysics);
+    RunPhase(config, "SetupRendering", SetupRendering);
+    RunPhase(config, "SetupDevices",   SetupDevices);
+    if (!config.reportFile.empty())
+        config.report.Write(config.reportFile);
+
+    if (config.profiler != NULL)
+        config.setup.GetEngine().DeinitializeEvent()
+            .Attach(*(new ProfileWriter(*config.profiler, config.profileFile)));
 
     // Possibly add some debugging stuff
     //config.setup.EnableDebugging();
@@ -158,8 +407,120 @@ int main(int argc, char** argv) {
     return EXIT_SUCCESS;
 }
 
+void RunPhase(Config& config, string name, void (*phase)(Config&)) {
+    StartupReport::Scope scope(config.report, StartupReport::PHASE, name);
+    phase(config);
+}
+
+void ParseArguments(Config& config, int argc, char** argv) {
+    for (int i = 1; i < argc; i++) {
+        string arg(argv[i]);
+        if (arg == "--headless") {
+            config.headless = true;
+            if (i+1 < argc && isdigit(argv[i+1][0]))
+                config.headlessTicks = atoi(argv[++i]);
+        }
+        else if (arg == "--record" && i+1 < argc)
+            config.recordFile = argv[++i];
+        else if (arg == "--replay" && i+1 < argc)
+            config.replayFile = argv[++i];
+        else if (arg == "--load-threads" && i+1 < argc)
+            config.loadThreads = atoi(argv[++i]);
+        else if (arg == "--cache-dir" && i+1 < argc)
+            config.cacheDir = argv[++i];
+        else if (arg == "--no-cache")
+            config.serialize = false;
+        else if (arg == "--profile" && i+1 < argc) {
+            config.profileFile = argv[++i];
+            config.profiler = new Profiler();
+        }
+        else if (arg == "--startup-report" && i+1 < argc)
+            config.reportFile = argv[++i];
+        else if (arg == "--vehicles" && i+1 < argc)
+            config.aiVehicles = atoi(argv[++i]);
+        else if (arg == "--physics-thread") {
+            config.physicsThread = true;
+            if (i+1 < argc && isdigit(argv[i+1][0]))
+                config.physicsRate = atoi(argv[++i]);
+            if (config.physicsRate < ThreadedPhysics::MIN_RATE) {
+                config.physicsRate = ThreadedPhysics::MIN_RATE;
+                logger.warning << "Physics rate raised to "
+                               << config.physicsRate << " Hz" << logger.end;
+            }
+        }
+        else if (arg == "--no-interpolation")
+            config.interpolate = false;
+        else if (arg == "--no-culling")
+            config.culling = false;
+        else if (arg == "--no-render-list")
+            config.renderList = false;
+        else if (arg == "--no-batching")
+            config.batching = false;
+        else if (arg == "--mesh-opt")
+            config.meshOptimization = true;
+        else if (arg == "--no-arena")
+            config.arena = false;
+        else if (arg == "--direct-composition")
+            config.directComposition = true;
+        else if (arg == "--frame-benchmark" && i+1 < argc)
+            config.benchmarkFrames = atoi(argv[++i]);
+        else if (arg == "--mesh-benchmark") {
+            config.meshBenchmark = true;
+            if (i+1 < argc && argv[i+1][0] != '-')
+                config.meshBenchmarkFile = argv[++i];
+        }
+        else if (arg == "--lod-levels" && i+1 < argc)
+            config.lodLevels = atoi(argv[++i]);
+        else if (arg == "--lod-cell" && i+1 < argc)
+            config.lodCellSize = atof(argv[++i]);
+        else if (arg == "--stream-tiles" && i+1 < argc)
+            config.tileSize = atof(argv[++i]);
+        else if (arg == "--tile-budget" && i+1 < argc)
+            config.tileBudget = atoi(argv[++i]);
+        else if (arg == "--build-benchmark") {
+            config.buildBenchmark = true;
+            config.headless = true;
+        }
+        else if (arg == "--tune-partition") {
+            config.tunePartition = true;
+            if (i+1 < argc && argv[i+1][0] != '-')
+                config.tuneFile = argv[++i];
+        }
+        else if (arg == "--sweep" && i+1 < argc) {
+            config.sweepGrid = argv[++i];
+            config.headless = true;
+            if (i+1 < argc && argv[i+1][0] != '-')
+                config.sweepFile = argv[++i];
+        }
+        else if (arg == "--pack" && i+1 < argc) {
+            config.packFile = argv[++i];
+            config.headless = true;
+        }
+        else if (arg == "--track-pack" && i+1 < argc)
+            config.trackPack = argv[++i];
+        else if (arg == "--collision-benchmark") {
+            config.collisionBenchmark = "both";
+            config.headless = true;
+            if (i+1 < argc && argv[i+1][0] != '-')
+                config.collisionBenchmark = argv[++i];
+        }
+        else
+            logger.warning << "Unknown argument: " << arg << logger.end;
+    }
+
+    // Input logs are stamped with the ticks of the engine thread
+    if (config.physicsThread &&
+        (!config.recordFile.empty() || !config.replayFile.empty())) {
+        logger.warning << "Input logs need the physics on the engine thread,"
+                       << " ignoring --physics-thread" << logger.end;
+        config.physicsThread = false;
+    }
+}
+
 void SetupResources(Config& config) {
     config.setup.AddDataDirectory("projects/OERacer/data/");
+    if (!config.trackPack.empty())
+        config.pack = new TrackPack(config.trackPack, config.cacheDir);
 }
 
 void SetupDisplay(Config& config) {
@@ -185,25 +546,81 @@ void SetupRendering(Config& config) {
     //config.renderer->InitializeEvent().Attach(*tl);
     // config.setup.GetRenderer().InitializeEvent().Attach(*dlt);
 
+    // Order the triangles for the vertex cache. Off by default: the
+    // vertex arrays are not indexed, so no vertex is reused yet.
+    if (config.meshOptimization) {
+        StartupReport::Scope scope(config.report, StartupReport::TRANSFORM,
+                                   "MeshOptimizer");
+        MeshOptimizer().Optimize(*config.renderingScene);
+    }
+
+    // Cull the static scene per view, before its faces become vertex arrays
+    if (config.culling) {
+        StartupReport::Scope scope(config.report, StartupReport::TRANSFORM,
+                                   "CullingPass");
+        config.cullingPass = new CullingPass();
+        config.cullingPass->Build(*config.staticScene);
+        config.setup.GetEngine().ProcessEvent().Attach(*config.cullingPass);
+        config.setup.GetEngine().DeinitializeEvent().Attach(*config.cullingPass);
+    }
+
+    // Coarser levels of the static geometry for distant views
+    if (config.lodLevels > 1) {
+        StartupReport::Scope scope(config.report, StartupReport::TRANSFORM,
+                                   "LODGenerator");
+        config.lodSelector = new LODSelector();
+        vector<float> thresholds;
+        for (float t = 0.2f; thresholds.size() + 1 < config.lodLevels; t /= 4.0f)
+            thresholds.push_back(t);
+        config.lodSelector->SetThresholds(thresholds);
+        LODGenerator(config.lodLevels, config.lodCellSize, config.loadThreads)
+            .Generate(*config.staticScene, *config.lodSelector);
+    }
+
     // Transform the scene to use vertex arrays
-    VertexArrayTransformer vaT;
-    vaT.Transform(*config.renderingScene);
+    {
+        StartupReport::Scope scope(config.report, StartupReport::TRANSFORM,
+                                   "VertexArrayTransformer");
+        VertexArrayTransformer vaT;
+        vaT.Transform(*config.renderingScene);
+    }
+
+    // Render the scenes below the render state through a flat render
+    // list, compiled at the first frame
+    if (config.renderList) {
+        SceneNode* content = new SceneNode();
+        config.renderingScene->RemoveNode(config.dynamicScene);
+        config.renderingScene->RemoveNode(config.staticScene);
+        content->AddNode(config.dynamicScene);
+        content->AddNode(config.staticScene);
+        config.renderListNode = new RenderListNode(*content);
+        config.renderingScene->AddNode(config.renderListNode);
+        config.setup.GetEngine().ProcessEvent().Attach(*config.renderListNode);
+    }
 
     // Supply the scene to the renderer
     delete config.setup.GetScene();
     config.setup.SetScene(*config.renderingScene);
 
+    // With direct composition the views are copied into their quarter
+    // of one shared target instead of through the split screen canvases
+    SharedTarget* target = config.directComposition ? new SharedTarget() : NULL;
+    RegionCopy* r1 = target ? new RegionCopy(*target, 0.0f, 0.0f) : NULL;
+    RegionCopy* r2 = target ? new RegionCopy(*target, 0.5f, 0.0f) : NULL;
+    RegionCopy* r3 = target ? new RegionCopy(*target, 0.5f, 0.5f) : NULL;
+    RegionCopy* r4 = target ? new RegionCopy(*target, 0.0f, 0.5f) : NULL;
+
     // bottom left
     IRenderCanvas* _c1 = config.setup.GetCanvas();
     IRenderer* r = _c1->GetRenderer();
 
-    IRenderCanvas* c1 = new ColorStereoCanvas(new TextureCopy());
+    IRenderCanvas* c1 = new ColorStereoCanvas(CanvasBackend(config, "bottom left", _c1->GetViewingVolume(), r1));
     c1->SetRenderer(r);
     c1->SetScene(_c1->GetScene());
     c1->SetViewingVolume(_c1->GetViewingVolume());
 
     // bottom right
-    IRenderCanvas* c2 = new RenderCanvas(new TextureCopy());
+    IRenderCanvas* c2 = new RenderCanvas(CanvasBackend(config, "bottom right", config.cam_br, r2));
     c2->SetViewingVolume(config.cam_br);
     c2->SetRenderer(r);
     c2->SetScene(config.renderingScene);
@@ -211,7 +628,7 @@ void SetupRendering(Config& config) {
     config.cam_br->LookAt(0,0,0);
 
     // top right
-    IRenderCanvas* c3 = new RenderCanvas(new TextureCopy());
+    IRenderCanvas* c3 = new RenderCanvas(CanvasBackend(config, "top right", config.cam_tr, r3));
     c3->SetViewingVolume(config.cam_tr);
     c3->SetRenderer(r);
     c3->SetScene(config.renderingScene);
@@ -220,17 +637,71 @@ void SetupRendering(Config& config) {
 
 
     // top left
-    IRenderCanvas* c4 = new RenderCanvas(new TextureCopy());
+    IRenderCanvas* c4 = new RenderCanvas(CanvasBackend(config, "top left", config.cam_tl, r4));
     c4->SetViewingVolume(config.cam_tl);
     c4->SetRenderer(r);
     c4->SetScene(config.renderingScene);
     config.cam_tl->SetPosition(Vector<3,float>(0,1000,0));
     config.cam_tl->LookAt(0,0,0);
 
-    SplitScreenCanvas* left = new SplitScreenCanvas(new TextureCopy(), *c4, *c1, SplitScreenCanvas::HORIZONTAL);
-    SplitScreenCanvas* right = new SplitScreenCanvas(new TextureCopy(), *c3, *c2, SplitScreenCanvas::HORIZONTAL);
-    SplitScreenCanvas* canvas = new SplitScreenCanvas(new TextureCopy(), *left, *right);
-    config.setup.GetFrame().SetCanvas(canvas);
+    if (target != NULL) {
+        CompositeCanvas* canvas = new CompositeCanvas(target);
+        canvas->Add(*c1, 0.5f, 0.5f);
+        canvas->Add(*c2, 0.5f, 0.5f);
+        canvas->Add(*c3, 0.5f, 0.5f);
+        canvas->Add(*c4, 0.5f, 0.5f);
+        config.setup.GetFrame().SetCanvas(canvas);
+    } else {
+        SplitScreenCanvas* left = new SplitScreenCanvas(CanvasBackend(config, "split left"), *c4, *c1, SplitScreenCanvas::HORIZONTAL);
+        SplitScreenCanvas* right = new SplitScreenCanvas(CanvasBackend(config, "split right"), *c3, *c2, SplitScreenCanvas::HORIZONTAL);
+        SplitScreenCanvas* canvas = new SplitScreenCanvas(CanvasBackend(config, "split frame"), *left, *right);
+        config.setup.GetFrame().SetCanvas(canvas);
+    }
+
+    if (config.benchmarkFrames > 0)
+        config.setup.GetEngine().ProcessEvent()
+            .Attach(*(new FrameBenchmark(config.setup.GetEngine(),
+                                         config.setup.GetFrame(),
+                                         config.benchmarkFrames,
+                                         config.directComposition)));
+
+    // Stream the static scene around the player's vehicle
+    if (config.tileSize > 0 && config.fleet.GetSize() > 0) {
+        TileStreamer* streamer =
+            new TileStreamer(config.cacheDir, config.tilesKey, config.tiles,
+                             *config.staticScene, config.fleet.GetNode(0));
+        streamer->SetBudget((unsigned long)config.tileBudget * 1024 * 1024);
+        streamer->SetRenderList(config.renderListNode);
+        streamer->AddView(_c1->GetViewingVolume());
+        streamer->AddView(config.cam_br);
+        streamer->AddView(config.cam_tr);
+        streamer->AddView(config.cam_tl);
+        config.setup.GetEngine().InitializeEvent().Attach(*streamer);
+        config.setup.GetEngine().ProcessEvent().Attach(Profiled(config, *streamer, "TileStreamer"));
+        config.setup.GetEngine().DeinitializeEvent().Attach(*streamer);
+    }
+}
+
+// Time a process listener when profiling is enabled
+IListener<OpenEngine::Core::ProcessEventArg>&
+Profiled(Config& config, IListener<OpenEngine::Core::ProcessEventArg>& listener, string name) {
+    if (config.profiler == NULL) return listener;
+    return *(new ProfiledListener<OpenEngine::Core::ProcessEventArg>(listener, *config.profiler, name));
+}
+
+// Backend of a canvas, culling the static scene and selecting its
+// level of detail for the view of the canvas, and timed when profiling
+// is enabled. The base backend copies the rendered canvas, into a
+// texture of its own unless another one is given.
+ICanvasBackend* CanvasBackend(Config& config, string name, IViewingVolume* view,
+                              ICanvasBackend* base) {
+    ICanvasBackend* backend = (base != NULL) ? base : new TextureCopy();
+    if (config.cullingPass != NULL && view != NULL)
+        backend = config.cullingPass->CreateBackend(backend, config.cullingPass->AddView(view));
+    if (config.lodSelector != NULL && view != NULL)
+        backend = new ViewBackend(backend, *config.lodSelector, config.lodSelector->AddView(view));
+    if (config.profiler == NULL) return backend;
+    return new ProfiledCanvasBackend(backend, *config.profiler, name);
 }
 
 void SetupDevices(Config& config) {
@@ -239,19 +710,48 @@ void SetupDevices(Config& config) {
     config.setup.GetKeyboard().KeyEvent().Attach(*move_h);
 
     // Keyboard bindings to the rigid box and camera
-    KeyboardHandler* keyHandler = new KeyboardHandler(config.setup.GetEngine(),
-                                                      config.camera,
-                                                      config.physicBody,
-                                                      config.physics);
+    // With a physics thread, controls are queued to it and the
+    // physics reset and pause keys are not available.
+    KeyboardHandler* keyHandler;
+    if (config.threadedPhysics != NULL)
+        keyHandler = new KeyboardHandler(config.setup.GetEngine(),
+                                         config.camera,
+                                         config.threadedPhysics,
+                                         0, NULL, NULL);
+    else
+        keyHandler = new KeyboardHandler(config.setup.GetEngine(),
+                                         config.camera,
+                                         &config.fleet,
+                                         0,
+                                         config.physicBody,
+                                         config.physics);
     config.setup.GetKeyboard().KeyEvent().Attach(*keyHandler);
     config.setup.GetJoystick().JoystickAxisEvent().Attach(*keyHandler);
 
-    config.setup.GetEngine().InitializeEvent().Attach(*keyHandler);
-    config.setup.GetEngine().ProcessEvent().Attach(*keyHandler);
-    config.setup.GetEngine().DeinitializeEvent().Attach(*keyHandler);
+    // Record or replay the vehicle input, stamped with the physics
+    // tick, so a log drives the vehicle the same way in every run,
+    // windowed or headless
+    if (!config.recordFile.empty()) {
+        InputRecorder* recorder = new InputRecorder(config.recordFile, *keyHandler);
+        config.setup.GetKeyboard().KeyEvent().Attach(*recorder);
+        config.setup.GetJoystick().JoystickAxisEvent().Attach(*recorder);
+    }
+    InputPlayer* player = NULL;
+    if (!config.replayFile.empty())
+        player = new InputPlayer(config.replayFile, *keyHandler);
+
+    // The simulation runs the handler once per physics tick, the
+    // physics thread gets its controls once per frame
+    if (config.simulation != NULL)
+        config.simulation->SetInput(keyHandler, player);
+    else {
+        config.setup.GetEngine().InitializeEvent().Attach(*keyHandler);
+        config.setup.GetEngine().ProcessEvent().Attach(Profiled(config, *keyHandler, "KeyboardHandler"));
+        config.setup.GetEngine().DeinitializeEvent().Attach(*keyHandler);
+    }
 
     config.setup.GetEngine().InitializeEvent().Attach(*move_h);
-    config.setup.GetEngine().ProcessEvent().Attach(*move_h);
+    config.setup.GetEngine().ProcessEvent().Attach(Profiled(config, *move_h, "MoveHandler"));
     
     config.setup.GetMouse().MouseMovedEvent().Attach(*move_h);
 
@@ -263,56 +763,128 @@ void SetupPhysics(Config& config) {
         config.physicScene == NULL)
         throw Exception("Physics dependencies are not satisfied.");
 
-    if (config.serialize) {
-        ifstream isf("oeracer-physics-scene.bin", ios::binary);
-        if (isf.is_open()) {
-            logger.info << "Loading the physics tree from file: started"
-                        << logger.end;
+    // A tree prebuilt with the same parameters is used from the pack
+    ISceneNode* packed = NULL;
+    if (config.pack != NULL && config.serialize)
+        packed = config.pack->LoadPhysics(
+            TrackPack::PhysicsKey(config.physicsMaxFaceCount,
+                                  config.physicsMaxQuadSize));
+
+    if (packed != NULL) {
+        logger.info << "Loaded the physics tree from " << config.trackPack
+                    << logger.end;
+        delete config.physicScene;
+        config.physicScene = packed;
+    }
+    else if (config.serialize) {
+        // Key the cache on the physics meshes and the tree parameters
+        CacheKey key;
+        key.Add(string("physics tree 1"));
+        key.Add(config.physicsMaxFaceCount);
+        key.Add(config.physicsMaxQuadSize);
+        if (config.pack != NULL)
+            config.pack->AddTo(key);
+        else
+            for (unsigned int i = 0; i < config.models.size(); i++)
+                if (config.models[i].section == SECTION_PHYSIC ||
+                    config.models[i].section == SECTION_SHARED)
+                    key.AddFile(config.models[i].file);
+
+        SceneCache cache(config.cacheDir);
+        ISceneNode* cached = cache.Load("physics", key.Get());
+        if (cached != NULL) {
+            logger.info << "Loaded the physics tree from "
+                        << cache.GetPath("physics", key.Get()) << logger.end;
             delete config.physicScene;
-            BinaryStreamArchiveReader reader(isf);
-            config.physicScene = reader.ReadScene("physics");
-            isf.close();
-            logger.info << "Loading the physics tree from file: done"
-                        << logger.end;
+            config.physicScene = cached;
         } else {
-            isf.close();
             logger.info << "Creating and serializing the physics tree: started"
                         << logger.end;
-            // transform the object tree to a hybrid Quad/BSP
-            CollectedGeometryTransformer collT;
-            QuadTransformer quadT;
-            BSPTransformer bspT;
-            collT.Transform(*config.physicScene);
-            quadT.Transform(*config.physicScene);
-            bspT.Transform(*config.physicScene);
-            // serialize the scene
-            ofstream of("oeracer-physics-scene.bin");
-            BinaryStreamArchiveWriter writer(of);
-            writer.WriteScene("physics", config.physicScene);
-            of.close();
+            BuildPhysicsTree(config);
+            cache.Save("physics", key.Get(), config.physicScene);
             logger.info << "Creating and serializing the physics tree: done"
                         << logger.end;
         }
     } else {
-        // transform the object tree to a hybrid Quad/BSP
-        CollectedGeometryTransformer collT;
-        QuadTransformer quadT;
-        BSPTransformer bspT;
-        collT.Transform(*config.physicScene);
-        quadT.Transform(*config.physicScene);
-        bspT.Transform(*config.physicScene);
+        BuildPhysicsTree(config);
+    }
+
+    // Pack the faces of the physics tree into one block. The static
+    // scene is left alone, the rendering transforms replace its faces
+    // anyway. Traversals are only timed when profiling.
+    if (config.arena) {
+        StartupReport::Scope scope(config.report, StartupReport::TRANSFORM,
+                                   "FaceArena");
+        FaceArena arena(config.profiler != NULL);
+        arena.Add("physicScene", config.physicScene);
+        arena.Compact();
     }
     
     config.physics = new FixedTimeStepPhysics(config.physicScene);
 
     // Add physic bodies
-    config.physics->AddRigidBody(config.physicBody);
+    for (unsigned int i = 0; i < config.fleet.GetSize(); i++)
+        config.physics->AddRigidBody(config.fleet.GetBox(i));
+
+    LogSceneMemory(config);
+
+    // Run the physics on its own thread, together with the AI
+    if (config.physicsThread) {
+        config.threadedPhysics = new ThreadedPhysics(*config.physics,
+                                                     config.fleet,
+                                                     config.bodyNodes,
+                                                     config.physicsRate);
+        config.threadedPhysics->AddController(config.ai);
+        config.threadedPhysics->SetInterpolation(config.interpolate);
+        config.setup.GetEngine().InitializeEvent().Attach(*config.threadedPhysics);
+        config.setup.GetEngine().ProcessEvent().Attach(*config.threadedPhysics);
+        config.setup.GetEngine().DeinitializeEvent().Attach(*config.threadedPhysics);
+        return;
+    }
+
+    // Step the AI, the vehicle controls and the physics together once
+    // per physics tick, as when running headless. SetupDevices adds
+    // the keyboard input.
+    config.fleet.SetFixedDelta(config.inputDelta);
+    config.simulation = new HeadlessSimulation(*config.physics, config.fleet);
+    config.simulation->AddController(config.ai);
+    RealTimeSimulation* rts = new RealTimeSimulation(*config.simulation,
+                                                     config.physicsRate);
+    config.setup.GetEngine().InitializeEvent().Attach(*rts);
+    config.setup.GetEngine().ProcessEvent().Attach(Profiled(config, *rts, "Simulation"));
+    config.setup.GetEngine().DeinitializeEvent().Attach(*rts);
+}
 
-    // Add to engine for processing time (with its timer)
-    FixedTimeStepPhysicsTimer* ptimer = new FixedTimeStepPhysicsTimer(*config.physics);
-    config.setup.GetEngine().InitializeEvent().Attach(*config.physics);
-    config.setup.GetEngine().ProcessEvent().Attach(*ptimer);
-    config.setup.GetEngine().DeinitializeEvent().Attach(*config.physics);
+void BuildPhysicsTree(Config& config) {
+    // transform the object tree to a hybrid Quad/BSP
+    CollectedGeometryTransformer collT;
+    QuadTransformer quadT;
+    ParallelBSPBuilder bspT(config.loadThreads);
+    if (config.physicsMaxFaceCount) quadT.SetMaxFaceCount(config.physicsMaxFaceCount);
+    if (config.physicsMaxQuadSize)  quadT.SetMaxQuadSize(config.physicsMaxQuadSize);
+    StartupReport::Scope collS(config.report, StartupReport::TRANSFORM,
+                               "physics CollectedGeometryTransformer");
+    collT.Transform(*config.physicScene);
+    collS.End();
+    StartupReport::Scope quadS(config.report, StartupReport::TRANSFORM,
+                               "physics QuadTransformer");
+    quadT.Transform(*config.physicScene);
+    quadS.End();
+    StartupReport::Scope bspS(config.report, StartupReport::TRANSFORM,
+                              "physics BSPTransformer");
+    bspT.Transform(*config.physicScene);
+    bspS.End();
+}
+
+void PartitionPhysicsScene(ISceneNode& scene, unsigned int maxFaceCount,
+                           unsigned int maxQuadSize) {
+    // the physics tree up to the BSP build, without reporting
+    CollectedGeometryTransformer collT;
+    QuadTransformer quadT;
+    if (maxFaceCount) quadT.SetMaxFaceCount(maxFaceCount);
+    if (maxQuadSize)  quadT.SetMaxQuadSize(maxQuadSize);
+    collT.Transform(scene);
+    quadT.Transform(scene);
 }
 
 void SetupScene(Config& config) {
@@ -341,70 +913,131 @@ void SetupScene(Config& config) {
     RenderStateHandler* rh = new RenderStateHandler(*rn);
     config.setup.GetKeyboard().KeyEvent().Attach(*rh);
 
+    if (config.pack != NULL)
+        config.models = config.pack->GetModels();
+    else
+        config.models = ReadModelList("projects/OERacer/models.txt");
+    vector<ModelEntry>& models = config.models;
+
+    // Hashing the static models reads them in full, so it is done once
+    if (!config.headless) {
+        config.staticKey = StaticSceneKey(config);
+        config.tilesKey = TilesKey(config);
+    }
+
+    // Use the partitioned static scene from the cache if it is valid,
+    // in which case the static models are not loaded at all. Running
+    // headless the static scene is not needed.
+    bool staticDone = config.headless;
+    if (config.tileSize > 0 && !config.headless) {
+        // Streamed tiles replace the static scene cache
+        if (config.serialize &&
+            TileStreamer::ReadIndex(config.cacheDir, config.tilesKey, config.tiles)) {
+            logger.info << "Streaming " << config.tiles.size()
+                        << " static tiles" << logger.end;
+            staticDone = true;
+        }
+    }
+    else if (config.serialize && !config.headless) {
+        SceneCache cache(config.cacheDir);
+        config.staticScene = cache.Load("static", config.staticKey);
+        if (config.staticScene != NULL) {
+            logger.info << "Loaded the static scene from "
+                        << cache.GetPath("static", config.staticKey)
+                        << logger.end;
+            staticDone = true;
+        }
+    }
+    // A physics tree from the pack replaces the physics models, see
+    // SetupPhysics
+    bool physicsDone = config.pack != NULL && config.serialize &&
+        config.pack->HasPhysics(TrackPack::PhysicsKey(config.physicsMaxFaceCount,
+                                                      config.physicsMaxQuadSize));
+    for (unsigned int i = 0; i < models.size(); i++) {
+        if (models[i].section == SECTION_STATIC && staticDone)
+            models[i].skip = true;
+        if (models[i].section == SECTION_PHYSIC && physicsDone)
+            models[i].skip = true;
+        if (models[i].section == SECTION_SHARED && staticDone && physicsDone)
+            models[i].skip = true;
+    }
+
     config.dynamicScene = new SceneNode();
-    config.staticScene = new SceneNode();
+    if (config.staticScene == NULL)
+        config.staticScene = new SceneNode();
     config.physicScene = new SceneNode();
 
     config.renderingScene->AddNode(config.dynamicScene);
     config.renderingScene->AddNode(config.staticScene);
 
-    ISceneNode* current = config.dynamicScene;
-
     // Position of the vehicle
-    Vector<3,float> position(2, 100, 2);
+    Vector<3,float> position = config.start;
 
-    // Add models from models.txt to the scene
-    ifstream* mfile = File::Open(DirectoryManager::FindFileInPath("projects/OERacer/models.txt"));
-    
-    bool dynamic = false;
-    while (!mfile->eof()) {
-        string mod_str;
-        getline(*mfile, mod_str);
-
-        // Check the string
-        if (mod_str[0] == '#' || mod_str == "") continue;
-
-        // switch to static elements
-        if (mod_str == "dynamic") {
-            dynamic = true;
-            current = config.dynamicScene;
-            continue;
-        }
-        else if (mod_str == "static") {
-            dynamic = false;
-            current = config.staticScene;
-            continue;
-        }
-        else if (mod_str == "physic") {
-            dynamic = false;
-            current = config.physicScene;
-            continue;
-        }
-        
-        // Load the model
-        IModelResourcePtr mod_res = ResourceManager<IModelResource>::Create(mod_str);
-        mod_res->Load();
-        if (mod_res->GetSceneNode() == NULL) continue;
+    // Vehicles after the first one are driven by the AI
+    config.ai = new AIDriver(config.fleet);
+    config.ai->SetCircuit(position, config.circuitSize, config.circuitPoints);
+    ISceneNode* playerNode = NULL;
+
+    // Load the models from the pack, or from models.txt in parallel
+    if (config.pack != NULL)
+        config.pack->Load(models);
+    else {
+        ModelLoader loader(config.loadThreads);
+        loader.Load(models);
+    }
+    for (unsigned int i = 0; i < models.size(); i++)
+        if (!models[i].skip)
+            config.report.Add(StartupReport::MODEL, models[i].file,
+                              models[i].loadTime, models[i].allocations);
+
+    // Add the models to the scene in the order they are listed
+    for (unsigned int i = 0; i < models.size(); i++) {
+        ModelEntry& entry = models[i];
+        if (entry.node == NULL) continue;
+
+        ISceneNode* current = config.dynamicScene;
+        if (entry.section == SECTION_STATIC) current = config.staticScene;
+        if (entry.section == SECTION_PHYSIC) current = config.physicScene;
+        bool dynamic = (entry.section == SECTION_DYNAMIC);
 
-        ISceneNode* mod_node = mod_res->GetSceneNode();
-        mod_res->Unload();
+        // Shared models go to the static scene and the physics scene
+        // gets a node referencing the same faces.
+        if (entry.section == SECTION_SHARED) {
+            if (staticDone) {
+                current = config.physicScene;
+            } else {
+                current = config.staticScene;
+                TransformationNode* phys_tran = new TransformationNode();
+                phys_tran->AddNode(SharedGeometryCollector().Collect(*entry.node));
+                config.physicScene->AddNode(phys_tran);
+            }
+        }
 
+        ISceneNode* mod_node = entry.node;
         TransformationNode* mod_tran = new TransformationNode();
         mod_tran->AddNode(mod_node);
-        if (dynamic) {
-            // Load riget-box
-            config.physicBody = new RigidBox( Box(*mod_node));
-            config.physicBody->SetCenter( position );
-            config.physicBody->SetTransformationNode(mod_tran);
-            config.physicBody->SetGravity(Vector<3,float>(0, -9.82*20, 0));
-            // Bind the follow camera
-            config.camera->SetPosition(position + Vector<3,float>(-150,40,0));
-            config.camera->LookAt(position - Vector<3,float>(0,30,0));
-            config.camera->Follow(mod_tran);
-            // bind the tracking cameras
-            config.cam_br->Track(mod_tran);
-            config.cam_tr->Track(mod_tran);
-            config.cam_tl->Track(mod_tran);
+        if (dynamic && config.physicBody != NULL) {
+            // Further vehicles are driven by the AI
+            Vector<3,float> offset(0, 0, 40.0 * config.fleet.GetSize());
+            CreateVehicle(config, mod_node, mod_tran, position + offset);
+            config.ai->AddVehicle(config.fleet.GetSize() - 1);
+        }
+        else if (dynamic) {
+            // The first vehicle is driven by the player
+            playerNode = mod_node;
+            config.vehicleModel = mod_node;
+            config.physicBody = CreateVehicle(config, mod_node, mod_tran, position);
+            // No cameras exist when running headless
+            if (config.camera != NULL) {
+                // Bind the follow camera
+                config.camera->SetPosition(position + Vector<3,float>(-150,40,0));
+                config.camera->LookAt(position - Vector<3,float>(0,30,0));
+                config.camera->Follow(mod_tran);
+                // bind the tracking cameras
+                config.cam_br->Track(mod_tran);
+                config.cam_tr->Track(mod_tran);
+                config.cam_tl->Track(mod_tran);
+            }
 
             // Set up a light node
             PointLightNode* pln = new PointLightNode();
@@ -414,15 +1047,114 @@ void SetupScene(Config& config) {
             mod_tran->AddNode(pln);
         }
         current->AddNode(mod_tran);
-        logger.info << "Successfully loaded " << mod_str << logger.end;
+        logger.info << "Successfully loaded " << entry.file
+                    << " (" << entry.loadTime / 1000 << " ms)" << logger.end;
     }
-    mfile->close();
-    delete mfile;
 
+    // Spawn AI opponents as copies of the player's vehicle, on a grid
+    // behind it
+    for (unsigned int i = 0; i < config.aiVehicles && playerNode != NULL; i++) {
+        TransformationNode* mod_tran = new TransformationNode();
+        mod_tran->AddNode(playerNode->Clone());
+        Vector<3,float> offset(-40.0 * (1 + i / 4), 0, 30.0 * (i % 4) - 45.0);
+        CreateVehicle(config, playerNode, mod_tran, position + offset);
+        config.ai->AddVehicle(config.fleet.GetSize() - 1);
+        config.dynamicScene->AddNode(mod_tran);
+    }
+    if (config.fleet.GetSize() > 1)
+        logger.info << "Added " << config.fleet.GetSize() - 1
+                    << " AI vehicles" << logger.end;
+
+    if (!staticDone) {
+        PartitionStaticScene(config);
+        if (config.tileSize > 0) {
+            if (!TileStreamer::Cut(*config.staticScene, config.tileSize,
+                                   config.cacheDir, config.tilesKey, config.tiles))
+                logger.error << "Could not store the static tiles in "
+                             << config.cacheDir << logger.end;
+        }
+        else if (config.serialize) {
+            SceneCache cache(config.cacheDir);
+            cache.Save("static", config.staticKey, config.staticScene);
+        }
+    }
+}
+
+RigidBox* CreateVehicle(Config& config, ISceneNode* mod_node,
+                        TransformationNode* mod_tran, Vector<3,float> position) {
+    RigidBox* box = new RigidBox( Box(*mod_node));
+    box->SetCenter( position );
+    if (config.physicsThread && !config.headless) {
+        // the physics thread publishes the private node into mod_tran
+        TransformationNode* body = new TransformationNode();
+        box->SetTransformationNode(body);
+        config.bodyNodes.push_back(body);
+    } else
+        box->SetTransformationNode(mod_tran);
+    box->SetGravity(Vector<3,float>(0, -config.gravity, 0));
+    config.fleet.Add(box, mod_tran);
+    return box;
+}
+
+CacheHash StaticSceneKey(Config& config) {
+    CacheKey key;
+    key.Add(string("static scene 2"));
+    key.Add(config.renderMaxFaceCount);
+    key.Add(config.renderMaxQuadSize);
+    key.Add((unsigned int)config.batching);
+    if (config.pack != NULL)
+        config.pack->AddTo(key);
+    else
+        for (unsigned int i = 0; i < config.models.size(); i++)
+            if (config.models[i].section == SECTION_STATIC ||
+                config.models[i].section == SECTION_SHARED)
+                AddModelFiles(key, config.models[i].file);
+    return key.Get();
+}
+
+// Hash a model with its material libraries and textures
+void AddModelFiles(CacheKey& key, string file) {
+    key.AddFile(file);
+    vector<string> libs = ModelLoader::MaterialLibraries(file);
+    for (unsigned int i = 0; i < libs.size(); i++)
+        key.AddFile(libs[i]);
+    vector<string> textures = ModelLoader::TextureNames(file);
+    for (unsigned int i = 0; i < textures.size(); i++)
+        key.AddFile(textures[i]);
+}
+
+// Needs config.staticKey
+CacheHash TilesKey(Config& config) {
+    CacheKey key;
+    key.Add(string("static tiles 1"));
+    CacheHash scene = config.staticKey;
+    key.Add((const char*)&scene, sizeof(scene));
+    key.Add(config.tileSize);
+    return key.Get();
+}
+
+void LogSceneMemory(Config& config) {
+    // Faces referenced from an earlier scene are reported as shared
+    SceneMemoryVisitor mem;
+    mem.Log("dynamicScene", config.dynamicScene);
+    mem.Log("staticScene",  config.staticScene);
+    mem.Log("physicScene",  config.physicScene);
+}
+
+void PartitionStaticScene(Config& config) {
     QuadTransformer quadT;
-    quadT.SetMaxFaceCount(500);
-    quadT.SetMaxQuadSize(100);
+    quadT.SetMaxFaceCount(config.renderMaxFaceCount);
+    quadT.SetMaxQuadSize(config.renderMaxQuadSize);
+    StartupReport::Scope scope(config.report, StartupReport::TRANSFORM,
+                               "static QuadTransformer");
     quadT.Transform(*config.staticScene);
+    scope.End();
+
+    if (config.batching) {
+        StartupReport::Scope batch(config.report, StartupReport::TRANSFORM,
+                                   "static StaticBatcher");
+        StaticBatcher().Batch(*config.staticScene);
+    }
 }
 
 void SetupDebugging(Config& config) {
@@ -454,5 +1186,514 @@ void SetupDebugging(Config& config) {
             logger.info << "Saved physics graph to '"
                         << itr->first << ".dot'" << logger.end;
         }
+        TreeStats().Log(itr->first, itr->second);
+    }
+}
+
+void RunHeadless(Config& config) {
+    config.fleet.SetFixedDelta(config.inputDelta);
+    HeadlessSimulation sim(*config.physics, config.fleet);
+    KeyboardHandler* keyHandler = NULL;
+    InputPlayer* player = NULL;
+    AttachHeadlessInput(config, sim, keyHandler, player);
+
+    sim.Run(config.headlessTicks);
+
+    delete player;
+    delete keyHandler;
+}
+
+void AttachHeadlessInput(Config& config, HeadlessSimulation& sim,
+                         KeyboardHandler*& keyHandler, InputPlayer*& player) {
+    sim.AddController(config.ai);
+    if (!config.replayFile.empty()) {
+        keyHandler = new KeyboardHandler(config.setup.GetEngine(),
+                                         NULL,
+                                         &config.fleet,
+                                         0,
+                                         config.physicBody,
+                                         config.physics);
+        player = new InputPlayer(config.replayFile, *keyHandler);
+        sim.SetInput(keyHandler, player);
+    }
+}
+
+void RunMeshBenchmark(Config& config) {
+    vector<ModelEntry> models = ReadModelList("projects/OERacer/models.txt");
+    ModelLoader loader(config.loadThreads);
+    loader.Load(models);
+
+    std::ofstream csv;
+    if (!config.meshBenchmarkFile.empty()) {
+        csv.open(config.meshBenchmarkFile.c_str());
+        csv << "model,triangles,vertices,welded_vertices,unindexed_bytes,"
+            << "indexed_bytes,quantized_bytes,acmr_before,acmr_after\n";
+    }
+    for (unsigned int i = 0; i < models.size(); i++) {
+        if (models[i].node == NULL) continue;
+        GeometryNode* geom = SharedGeometryCollector().Collect(*models[i].node);
+        MeshStats s(*geom->GetFaceSet());
+        logger.info << models[i].file << ": " << s.triangles << " triangles, "
+                    << s.vertices << " -> " << s.weldedVertices << " vertices, "
+                    << s.unindexedBytes / 1024 << " KB -> "
+                    << s.indexedBytes / 1024 << " KB indexed, "
+                    << s.quantizedBytes / 1024 << " KB quantized, estimated ACMR "
+                    << s.acmrBefore << " -> " << s.acmrAfter << logger.end;
+        if (csv.is_open())
+            csv << models[i].file << "," << s.triangles << "," << s.vertices << ","
+                << s.weldedVertices << "," << s.unindexedBytes << ","
+                << s.indexedBytes << "," << s.quantizedBytes << ","
+                << s.acmrBefore << "," << s.acmrAfter << "\n";
+    }
+}
+
+void RunBuildBenchmark(Config& config) {
+    string source = SceneCache::Serialize("physics", config.physicScene);
+    string reference;
+    double serial = 0;
+    unsigned int cores = WorkerPool::HardwareThreads();
+
+    // threads 0 is the serial BSPTransformer the others are checked against
+    for (unsigned int threads = 0; ; threads = (threads == 0) ? 1 : threads * 2) {
+        if (threads > cores) threads = cores;
+        ISceneNode* scene = SceneCache::Parse("physics", source);
+        PartitionPhysicsScene(*scene, config.physicsMaxFaceCount,
+                              config.physicsMaxQuadSize);
+
+        Timer timer;
+        timer.Start();
+        if (threads == 0) {
+            BSPTransformer bspT;
+            bspT.Transform(*scene);
+        } else {
+            ParallelBSPBuilder bspT(threads);
+            bspT.Transform(*scene);
+        }
+        double ms = timer.GetElapsedTime().AsInt() / 1000.0;
+        string result = SceneCache::Serialize("physics", scene);
+        delete scene;
+
+        if (threads == 0) {
+            serial = ms;
+            reference = result;
+            logger.info << "BSP build serial: " << ms << " ms" << logger.end;
+        } else {
+            logger.info << "BSP build " << threads << " threads: " << ms
+                        << " ms, speedup " << serial / ms << ", "
+                        << (result == reference ? "identical" : "DIFFERENT")
+                        << " to the serial tree" << logger.end;
+        }
+        if (threads == cores) break;
+    }
+}
+
+/**
+ * Run one box query and a ground and a forward ray per sample of the
+ * path. The forward ray reaches 50 ticks ahead. Returns the queries per
+ * second, the overlap count and the sum of the ray distances, which
+ * should match between backends.
+ */
+template <class Backend>
+double RunCollisionQueries(Backend& backend, vector<float>& path, float extent,
+                           unsigned int passes, unsigned long& overlaps,
+                           double& distances) {
+    const float down[3] = { 0.0f, -1.0f, 0.0f };
+    const unsigned int samples = path.size() / 3;
+    overlaps = 0;
+    distances = 0;
+    Timer timer;
+    timer.Start();
+    for (unsigned int p = 0; p < passes; p++)
+        for (unsigned int i = 0; i < samples; i++) {
+            const float* o = &path[3*i];
+            float lo[3] = { o[0]-extent, o[1]-extent, o[2]-extent };
+            float hi[3] = { o[0]+extent, o[1]+extent, o[2]+extent };
+            overlaps += backend.Overlaps(lo, hi);
+            distances += backend.Ray(o, down, 100.0f);
+            float ahead[3] = { 0.0f, 0.0f, 0.0f };
+            if (i + 1 < samples)
+                for (unsigned int k = 0; k < 3; k++) ahead[k] = o[3+k] - o[k];
+            distances += backend.Ray(o, ahead, 50.0f);
+        }
+    double usec = timer.GetElapsedTime().AsInt();
+    return (usec > 0) ? passes * samples * 3 * 1000000.0 / usec : 0;
+}
+
+void RunCollisionBenchmark(Config& config) {
+    bool bvh = (config.collisionBenchmark != "quadbsp");
+    bool quadbsp = (config.collisionBenchmark != "bvh");
+    string source = SceneCache::Serialize("physics", config.physicScene);
+
+    // Record the path of the vehicle, driven by the AI or an input log
+    RunPhase(config, "SetupPhysics", SetupPhysics);
+    config.fleet.SetFixedDelta(config.inputDelta);
+    HeadlessSimulation sim(*config.physics, config.fleet);
+    KeyboardHandler* keyHandler = NULL;
+    InputPlayer* player = NULL;
+    AttachHeadlessInput(config, sim, keyHandler, player);
+    vector<float> path;
+    sim.Initialize();
+    for (unsigned int i = 0; i < config.headlessTicks; i++) {
+        sim.Step();
+        Vector<3,float> c = config.fleet.GetBox(0)->GetCenter();
+        path.push_back(c[0]);
+        path.push_back(c[1]);
+        path.push_back(c[2]);
     }
+    sim.Deinitialize();
+    delete player;
+    delete keyHandler;
+
+    // The box around the vehicle in any orientation
+    GeometryNode* body = SharedGeometryCollector().Collect(*config.fleet.GetNode(0));
+    float extent = 0.0f;
+    FaceSet* bodyFaces = body->GetFaceSet();
+    for (FaceList::iterator itr = bodyFaces->begin(); itr != bodyFaces->end(); itr++)
+        for (unsigned int c = 0; c < 3; c++)
+            extent = std::max(extent, (*itr)->vert[c].GetLength());
+    delete body;
+
+    const unsigned int passes = 10;
+    logger.info << "Collision benchmark: " << path.size() / 3 << " samples, "
+                << passes << " passes, box extent " << extent << logger.end;
+    unsigned long overlaps;
+    double distances;
+
+    if (quadbsp) {
+        ISceneNode* scene = SceneCache::Parse("physics", source);
+        Timer timer;
+        timer.Start();
+        PartitionPhysicsScene(*scene, config.physicsMaxFaceCount,
+                              config.physicsMaxQuadSize);
+        ParallelBSPBuilder(config.loadThreads).Transform(*scene);
+        double build = timer.GetElapsedTime().AsInt() / 1000.0;
+        QuadBSPQuery query(*scene);
+        double rate = RunCollisionQueries(query, path, extent, passes,
+                                          overlaps, distances);
+        logger.info << "Quad/BSP: build " << build << " ms, "
+                    << query.GetBytes() / 1024 << " KB, " << rate
+                    << " queries/sec (overlaps " << overlaps
+                    << ", ray distances " << distances << ")" << logger.end;
+        delete scene;
+    }
+
+    if (bvh) {
+        // the same world space triangles the quad tree is built from
+        ISceneNode* scene = SceneCache::Parse("physics", source);
+        CollectedGeometryTransformer collT;
+        collT.Transform(*scene);
+        GeometryNode* geom = SharedGeometryCollector().Collect(*scene);
+        TriangleBVH tree;
+        Timer timer;
+        timer.Start();
+        tree.Build(*geom->GetFaceSet());
+        double build = timer.GetElapsedTime().AsInt() / 1000.0;
+        delete geom;
+        delete scene;
+        double rate = RunCollisionQueries(tree, path, extent, passes,
+                                          overlaps, distances);
+        logger.info << "BVH: build " << build << " ms, "
+                    << tree.GetNodeCount() << " nodes, "
+                    << tree.GetBytes() / 1024 << " KB, " << rate
+                    << " queries/sec (overlaps " << overlaps
+                    << ", ray distances " << distances << ")" << logger.end;
+    }
+}
+
+void RunSweep(Config& config) {
+    if (config.vehicleModel == NULL || config.fleet.GetSize() == 0)
+        throw Exception("Sweep dependencies are not satisfied.");
+
+    SweepCase base;
+    base.speed = config.fleet.GetSpeed();
+    base.turn = config.fleet.GetTurn();
+    base.gravity = config.gravity;
+    base.delta = config.inputDelta;
+    vector<SweepCase> cases = SweepRunner::ReadGrid(config.sweepGrid, base);
+
+    // The worlds share the physics tree and start where the player does
+    SweepRunner runner(config.physicScene, Box(*config.vehicleModel),
+                       config.fleet.GetBox(0)->GetCenter(),
+                       config.setup.GetEngine(), config.loadThreads);
+    runner.SetTicks(config.headlessTicks);
+    runner.SetWaypoints(config.ai->GetWaypoints());
+    KeyboardHandler* traceHandler = NULL;
+    InputPlayer* trace = NULL;
+    if (!config.replayFile.empty()) {
+        traceHandler = new KeyboardHandler(config.setup.GetEngine(),
+                                           NULL, NULL, 0, NULL, NULL);
+        trace = new InputPlayer(config.replayFile, *traceHandler);
+        runner.SetTrace(trace);
+    }
+
+    logger.info << "Sweep: " << cases.size() << " runs of "
+                << config.headlessTicks << " ticks on "
+                << runner.GetThreadCount() << " threads" << logger.end;
+    Timer timer;
+    timer.Start();
+    const vector<SweepResult>& results = runner.Run(cases);
+    double usec = timer.GetElapsedTime().AsInt();
+
+    std::ofstream csv(config.sweepFile.c_str());
+    if (!csv.good())
+        throw Exception("Can not open sweep output: " + config.sweepFile);
+    csv << "speed,turn,gravity,delta,lap_ticks,x,y,z,steps_per_sec\n";
+    unsigned int laps = 0, best = 0;
+    for (unsigned int i = 0; i < results.size(); i++) {
+        const SweepCase& c = cases[i];
+        const SweepResult& r = results[i];
+        csv << c.speed << "," << c.turn << "," << c.gravity << "," << c.delta << ","
+            << r.lapTicks << "," << r.position[0] << "," << r.position[1] << ","
+            << r.position[2] << "," << r.stepsPerSec << "\n";
+        if (r.lapTicks == 0) continue;
+        laps++;
+        if (best == 0 || r.lapTicks < results[best - 1].lapTicks) best = i + 1;
+    }
+    csv.close();
+
+    logger.info << "Sweep done in " << usec / 1000000.0 << " s, "
+                << (usec > 0 ? results.size() * 1000000.0 / usec : 0)
+                << " runs/sec, " << laps << " completed a lap" << logger.end;
+    if (best != 0) {
+        const SweepCase& c = cases[best - 1];
+        logger.info << "  fastest lap: " << results[best - 1].lapTicks
+                    << " ticks with speed " << c.speed << ", turn " << c.turn
+                    << ", gravity " << c.gravity << ", delta " << c.delta
+                    << logger.end;
+    }
+    logger.info << "Wrote " << config.sweepFile << logger.end;
+
+    delete trace;
+    delete traceHandler;
+}
+
+void RunPartitionTuner(Config& config) {
+    // The static and physics scenes as SetupScene builds them, before
+    // they are partitioned
+    vector<ModelEntry> models = ReadModelList("projects/OERacer/models.txt");
+    ModelLoader loader(config.loadThreads);
+    loader.Load(models);
+    SceneNode* staticRaw = new SceneNode();
+    SceneNode* physicRaw = new SceneNode();
+    for (unsigned int i = 0; i < models.size(); i++) {
+        ISceneNode* node = models[i].node;
+        if (node == NULL) continue;
+        if (models[i].section == SECTION_STATIC)
+            staticRaw->AddNode(node);
+        else if (models[i].section == SECTION_PHYSIC)
+            physicRaw->AddNode(node);
+        else if (models[i].section == SECTION_SHARED) {
+            physicRaw->AddNode(SharedGeometryCollector().Collect(*node));
+            staticRaw->AddNode(node);
+        }
+    }
+    string staticSource = SceneCache::Serialize("static", staticRaw);
+    string physicSource = SceneCache::Serialize("physics", physicRaw);
+    delete staticRaw;
+    delete physicRaw;
+
+    // Sample points along the AI circuit, in driving order, dropped
+    // onto the track
+    vector< Vector<3,float> > samples;
+    ISceneNode* ground = SceneCache::Parse("physics", physicSource);
+    CollectedGeometryTransformer collT;
+    collT.Transform(*ground);
+    GeometryNode* all = SharedGeometryCollector().Collect(*ground);
+    TriangleBVH groundBVH;
+    groundBVH.Build(*all->GetFaceSet());
+    AIDriver circuit(config.fleet);
+    circuit.SetCircuit(config.start, config.circuitSize, config.circuitPoints);
+    const vector< Vector<3,float> >& waypoints = circuit.GetWaypoints();
+    const unsigned int perLeg = 8;
+    const float above = 1000.0f;
+    for (unsigned int i = 0; i < waypoints.size(); i++)
+        for (unsigned int j = 0; j < perLeg; j++) {
+            Vector<3,float> next = waypoints[(i + 1) % waypoints.size()];
+            Vector<3,float> p = waypoints[i] + (next - waypoints[i]) * (float(j) / perLeg);
+            float o[3] = { p[0], p[1] + above, p[2] };
+            float d[3] = { 0, -1, 0 };
+            float t = groundBVH.Ray(o, d, FLT_MAX);
+            if (t < FLT_MAX) p[1] = o[1] - t;
+            samples.push_back(p);
+        }
+    delete all;
+    delete ground;
+
+    // A view above each sample looking at the next one, as the
+    // vehicle cameras would
+    vector<Camera*> views;
+    vector<ViewingVolume*> volumes;
+    Vector<3,float> up(0, 20, 0);
+    for (unsigned int i = 0; i < samples.size(); i++) {
+        Vector<3,float> next = samples[(i + 1) % samples.size()];
+        if ((next - samples[i]).GetLength() < 1.0f) continue;
+        ViewingVolume* volume = new ViewingVolume();
+        Camera* view = new Camera(*volume);
+        view->SetPosition(samples[i] + up);
+        view->LookAt(next + up);
+        views.push_back(view);
+        volumes.push_back(volume);
+    }
+
+    // A draw call costs about as much as drawing this many faces
+    const double drawCallFaces = 500;
+    const float extent = 10.0f;
+    const unsigned int faceCounts[] = { 100, 250, 500, 1000, 2000 };
+    const unsigned int quadSizes[]  = { 25, 50, 100, 200, 400 };
+    vector<PartitionSetting> settings;
+    logger.info << "Partition tuner: " << views.size() << " views, "
+                << samples.size() << " query boxes" << logger.end;
+
+    for (unsigned int a = 0; a < sizeof(faceCounts)/sizeof(faceCounts[0]); a++)
+        for (unsigned int b = 0; b < sizeof(quadSizes)/sizeof(quadSizes[0]); b++) {
+            PartitionSetting s;
+            s.maxFaceCount = faceCounts[a];
+            s.maxQuadSize = quadSizes[b];
+            TreeStats stats;
+
+            // static scene: faces and draw calls left after culling
+            ISceneNode* scene = SceneCache::Parse("static", staticSource);
+            Timer staticTimer;
+            staticTimer.Start();
+            QuadTransformer quadT;
+            quadT.SetMaxFaceCount(s.maxFaceCount);
+            quadT.SetMaxQuadSize(s.maxQuadSize);
+            quadT.Transform(*scene);
+            s.scene = "static";
+            s.buildTime = staticTimer.GetElapsedTime().AsInt() / 1000.0;
+            stats.Count(scene);
+            SceneMemoryVisitor mem;
+            mem.Count(scene);
+            s.nodes = stats.nodes;
+            s.depth = stats.maxDepth;
+            s.faces = stats.faces;
+            // mem counts the geometry and BSP nodes
+            s.bytes = mem.GetBytes()
+                + (unsigned long)stats.quadNodes * sizeof(QuadNode)
+                + (unsigned long)stats.transformationNodes * sizeof(TransformationNode)
+                + (unsigned long)(stats.nodes - stats.geometryNodes - stats.bspNodes
+                                  - stats.quadNodes - stats.transformationNodes)
+                  * sizeof(SceneNode);
+            VisibleGeometry visible(*scene);
+            unsigned long drawnFaces = 0, drawnNodes = 0;
+            for (unsigned int v = 0; v < views.size(); v++)
+                visible.Count(*views[v], drawnFaces, drawnNodes);
+            s.cost = views.empty() ? 0 :
+                (drawnFaces + drawCallFaces * drawnNodes) / views.size();
+            settings.push_back(s);
+            delete scene;
+
+            // physics tree: microseconds per box query
+            scene = SceneCache::Parse("physics", physicSource);
+            Timer physicsTimer;
+            physicsTimer.Start();
+            PartitionPhysicsScene(*scene, s.maxFaceCount, s.maxQuadSize);
+            ParallelBSPBuilder(config.loadThreads).Transform(*scene);
+            s.scene = "physics";
+            s.buildTime = physicsTimer.GetElapsedTime().AsInt() / 1000.0;
+            stats.Count(scene);
+            s.nodes = stats.nodes;
+            s.depth = stats.maxDepth;
+            s.faces = stats.faces;
+            QuadBSPQuery query(*scene);
+            s.bytes = query.GetBytes();
+            Timer queryTimer;
+            queryTimer.Start();
+            const unsigned int passes = 10;
+            for (unsigned int p = 0; p < passes; p++)
+                for (unsigned int i = 0; i < samples.size(); i++) {
+                    float lo[3], hi[3];
+                    for (unsigned int k = 0; k < 3; k++) {
+                        lo[k] = samples[i][k] - extent;
+                        hi[k] = samples[i][k] + extent;
+                    }
+                    query.Overlaps(lo, hi);
+                }
+            s.cost = samples.empty() ? 0 :
+                (double)queryTimer.GetElapsedTime().AsInt() / (passes * samples.size());
+            settings.push_back(s);
+            delete scene;
+        }
+
+    std::ofstream csv(config.tuneFile.c_str());
+    if (!csv.good())
+        throw Exception("Can not open partition output: " + config.tuneFile);
+    csv << "scene,max_faces,max_quad_size,build_ms,nodes,depth,face_refs,bytes,cost\n";
+    for (unsigned int i = 0; i < settings.size(); i++) {
+        const PartitionSetting& s = settings[i];
+        csv << s.scene << "," << s.maxFaceCount << "," << s.maxQuadSize << ","
+            << s.buildTime << "," << s.nodes << "," << s.depth << ","
+            << s.faces << "," << s.bytes << "," << s.cost << "\n";
+    }
+    csv.close();
+    logger.info << "Wrote " << config.tuneFile << logger.end;
+
+    const string scenes[] = { "static", "physics" };
+    const string costs[] = { "drawn faces per view, draw calls as "
+                             "500 faces", "us per box query" };
+    for (unsigned int i = 0; i < 2; i++) {
+        int best = PartitionSetting::Best(settings, scenes[i]);
+        if (best < 0) continue;
+        const PartitionSetting& s = settings[best];
+        logger.info << "Recommended " << scenes[i] << " partition: max face count "
+                    << s.maxFaceCount << ", max quad size " << s.maxQuadSize
+                    << " (" << s.cost << " " << costs[i] << ", build "
+                    << s.buildTime << " ms, " << s.nodes << " nodes, depth "
+                    << s.depth << ")" << logger.end;
+    }
+
+    // the cameras do not own their viewing volumes
+    for (unsigned int v = 0; v < views.size(); v++) {
+        delete views[v];
+        delete volumes[v];
+    }
+}
+
+void RunPack(Config& config) {
+    vector<ModelEntry> models = ReadModelList("projects/OERacer/models.txt");
+    ModelLoader loader(config.loadThreads);
+    loader.Load(models);
+
+    // The parsed models and the textures their materials name
+    TrackPackWriter pack;
+    std::set<string> textures;
+    for (unsigned int i = 0; i < models.size(); i++) {
+        if (models[i].node == NULL) continue;
+        pack.AddModel(models[i].file, models[i].section, models[i].node);
+        vector<string> names = ModelLoader::TextureNames(models[i].file);
+        for (unsigned int j = 0; j < names.size(); j++) {
+            if (!textures.insert(names[j]).second) continue;
+            if (!pack.AddTexture(names[j]))
+                logger.warning << "Texture not packed: " << names[j] << logger.end;
+        }
+    }
+
+    // The physics tree, built as SetupScene and SetupPhysics would
+    if (config.serialize) {
+        config.physicScene = new SceneNode();
+        for (unsigned int i = 0; i < models.size(); i++) {
+            ISceneNode* node = models[i].node;
+            if (node == NULL) continue;
+            TransformationNode* tran = new TransformationNode();
+            if (models[i].section == SECTION_PHYSIC)
+                tran->AddNode(node);
+            else if (models[i].section == SECTION_SHARED)
+                tran->AddNode(SharedGeometryCollector().Collect(*node));
+            else {
+                delete tran;
+                continue;
+            }
+            config.physicScene->AddNode(tran);
+        }
+        BuildPhysicsTree(config);
+        pack.AddPhysics(TrackPack::PhysicsKey(config.physicsMaxFaceCount,
+                                              config.physicsMaxQuadSize),
+                        config.physicScene);
+    }
+
+    if (!pack.Save(config.packFile))
+        throw Exception("Could not write track pack: " + config.packFile);
+    logger.info << "Packed " << pack.GetCount() << " entries ("
+                << textures.size() << " textures) into " << config.packFile
+                << logger.end;
 }